@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define BENCH_DIR "bench-work"
+#define BENCH_MAX_RUNS 64
+#define BENCH_OUTPUT 65536
+
+typedef struct {
+    const char* name;
+    int deps;
+    int blocks;
+    int lets;
+    int strings;
+    int string_len;
+    int kbchks;
+} Workload;
+
+typedef struct {
+    double wall;
+    double phase[6];
+    long rss_kb;
+} RunResult;
+
+const char* phase_names[6] = { "read", "lex", "parse", "codegen", "assemble", "link" };
+
+Workload workloads[] = {
+    { "lets", 0, 100, 500, 0, 0, 0 },
+    { "strings", 0, 100, 0, 100, 1000, 0 },
+    { "blocks", 0, 20000, 0, 0, 0, 1 },
+    { "deps", 16, 20, 20, 20, 40, 5 },
+};
+
+int scale = 1;
+int runs = 5;
+const char* out_path = "bench-results.json";
+
+double mono_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void ident(char* out, int n) {
+    int i = 0;
+    out[i++] = 'v';
+    do {
+        out[i++] = 'a' + n % 26;
+        n /= 26;
+    } while (n);
+    out[i] = '\0';
+}
+
+long write_unit(const char* path, Workload* w, int seed) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot write to %s\n", path);
+        exit(1);
+    }
+    char name[16];
+    int n = 0;
+    for (int b = 0; b < w->blocks * scale; b++) {
+        fputs("/+[\n", f);
+        for (int i = 0; i < w->lets; i++, n++) {
+            ident(name, n);
+            fprintf(f, " let %s = %d\n", name, (n * 7919 + seed) % 1000000);
+        }
+        for (int i = 0; i < w->strings; i++) {
+            fputs(" pnt \"", f);
+            for (int c = 0; c < w->string_len; c++) fputc(c % 32 == 31 ? ' ' : 'a' + (c + i + seed) % 26, f);
+            fputs("\"\n", f);
+        }
+        for (int i = 0; i < w->kbchks; i++) fputs(" kbchk\n", f);
+        fputs("/=]\n", f);
+    }
+    long size = ftell(f);
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Error: Cannot write to %s\n", path);
+        exit(1);
+    }
+    return size;
+}
+
+long generate(Workload* w, const char* dir) {
+    char path[512];
+    long bytes = 0;
+    mkdir(BENCH_DIR, 0755);
+    mkdir(dir, 0755);
+    snprintf(path, sizeof(path), "%s/project.noi", dir);
+    FILE* noi = fopen(path, "w");
+    if (!noi) {
+        fprintf(stderr, "Error: Cannot write to %s\n", path);
+        exit(1);
+    }
+    fprintf(noi, "kernel: %s\n", w->name);
+    if (w->deps) {
+        fputs("deps: ", noi);
+        for (int i = 0; i < w->deps; i++) fprintf(noi, "%sdep%d.nrs", i ? ", " : "", i);
+        fputc('\n', noi);
+    }
+    fputs("exit_key: \"q\"\n", noi);
+    fclose(noi);
+    for (int i = 0; i < w->deps; i++) {
+        snprintf(path, sizeof(path), "%s/dep%d.nrs", dir, i);
+        bytes += write_unit(path, w, i + 1);
+    }
+    snprintf(path, sizeof(path), "%s/main.nrs", dir);
+    return bytes + write_unit(path, w, 0);
+}
+
+int run_once(const char* compiler, const char* dir, RunResult* r) {
+    int fds[2];
+    if (pipe(fds) != 0) return 0;
+    double start = mono_time();
+    pid_t pid = fork();
+    if (pid < 0) return 0;
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (chdir(dir) != 0) _exit(127);
+        execl(compiler, compiler, "--no-cache", "--target", "linux", "--time-report", ".", (char*)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    char out[BENCH_OUTPUT];
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(fds[0], out + len, sizeof(out) - 1 - len)) != 0) {
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        len += n;
+        if (len == sizeof(out) - 1) {
+            char discard[4096];
+            while ((n = read(fds[0], discard, sizeof(discard))) > 0 || (n < 0 && errno == EINTR));
+            break;
+        }
+    }
+    out[len] = '\0';
+    close(fds[0]);
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) != pid) return 0;
+    r->wall = mono_time() - start;
+    r->rss_kb = ru.ru_maxrss;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return 0;
+    char* report = strstr(out, "Time report");
+    if (!report) return 0;
+    for (int p = 0; p < 6; p++) {
+        char key[32];
+        snprintf(key, sizeof(key), "\n  %s ", phase_names[p]);
+        char* line = strstr(report, key);
+        r->phase[p] = line ? strtod(line + strlen(key), NULL) / 1e3 : 0;
+    }
+    return 1;
+}
+
+int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+double throughput(long bytes, double seconds) {
+    return seconds > 0 ? bytes / seconds / 1e6 : 0;
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--scale N] [--runs N] [--out file]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (scale < 1) scale = 1;
+    if (runs < 1) runs = 1;
+    if (runs > BENCH_MAX_RUNS) runs = BENCH_MAX_RUNS;
+    char compiler[4096];
+    if (!realpath("n0ryst", compiler)) {
+        fprintf(stderr, "Error: Cannot find ./n0ryst, run make first\n");
+        return 1;
+    }
+    FILE* json = fopen(out_path, "w");
+    if (!json) {
+        fprintf(stderr, "Error: Cannot write to %s\n", out_path);
+        return 1;
+    }
+    fprintf(json, "{\"scale\":%d,\"runs\":%d,\"workloads\":[", scale, runs);
+    int failed = 0;
+    int count = sizeof(workloads) / sizeof(workloads[0]);
+    printf("%-8s %10s %10s %10s %10s %10s %10s %10s\n", "workload", "bytes", "lex MB/s", "parse MB/s", "cg MB/s", "wall ms", "median ms", "rss KB");
+    for (int i = 0; i < count; i++) {
+        Workload* w = &workloads[i];
+        char dir[256];
+        snprintf(dir, sizeof(dir), "%s/%s", BENCH_DIR, w->name);
+        long bytes = generate(w, dir);
+        RunResult best = { 0 };
+        double walls[BENCH_MAX_RUNS];
+        long rss = 0;
+        int ok = 1;
+        for (int r = 0; r < runs && ok; r++) {
+            RunResult res;
+            if (!run_once(compiler, dir, &res)) {
+                fprintf(stderr, "Error: Building workload %s failed\n", w->name);
+                ok = 0;
+                break;
+            }
+            walls[r] = res.wall;
+            if (res.rss_kb > rss) rss = res.rss_kb;
+            for (int p = 0; p < 6; p++) {
+                if (r == 0 || res.phase[p] < best.phase[p]) best.phase[p] = res.phase[p];
+            }
+        }
+        if (!ok) {
+            failed = 1;
+            continue;
+        }
+        qsort(walls, runs, sizeof(double), cmp_double);
+        double lex = throughput(bytes, best.phase[1]);
+        double parse = throughput(bytes, best.phase[2]);
+        double codegen = throughput(bytes, best.phase[3]);
+        printf("%-8s %10ld %10.1f %10.1f %10.1f %10.3f %10.3f %10ld\n", w->name, bytes, lex, parse, codegen,
+            walls[0] * 1e3, walls[runs / 2] * 1e3, rss);
+        fprintf(json, "%s\n{\"name\":\"%s\",\"units\":%d,\"bytes\":%ld,", i ? "," : "", w->name, w->deps + 1, bytes);
+        fprintf(json, "\"lex_mb_s\":%.3f,\"parse_mb_s\":%.3f,\"codegen_mb_s\":%.3f,", lex, parse, codegen);
+        for (int p = 0; p < 6; p++) fprintf(json, "\"%s_ms\":%.3f,", phase_names[p], best.phase[p] * 1e3);
+        fprintf(json, "\"wall_min_ms\":%.3f,\"wall_median_ms\":%.3f,\"wall_max_ms\":%.3f,\"peak_rss_kb\":%ld}",
+            walls[0] * 1e3, walls[runs / 2] * 1e3, walls[runs - 1] * 1e3, rss);
+    }
+    fprintf(json, "\n]}\n");
+    if (fclose(json) != 0) {
+        fprintf(stderr, "Error: Cannot write to %s\n", out_path);
+        return 1;
+    }
+    printf("Results written to %s\n", out_path);
+    return failed;
+}
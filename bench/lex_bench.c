@@ -0,0 +1,176 @@
+#define main n0ryst_main
+#include "../src/n0ryst.c"
+#undef main
+
+#include <time.h>
+
+#define BENCH_FILE "lex_bench.nrs"
+#define BENCH_SMALL (10u << 20)
+#define BENCH_LARGE (100u << 20)
+
+const char* bench_lines[] = {
+    "/+[\n",
+    " let score = 0\n",
+    " pnt \"Game started\"\n",
+    " let big = 5000000000\n",
+    " kbchk\n",
+    " pnt \"a somewhat longer string literal to scan through\"\n",
+    "/=]\n",
+};
+
+const char* bench_long_lines[] = {
+    "/+[\n",
+    " pnt \"a long status line that the lexer has to scan from the opening quote to the closing one, "
+        "padded out further so that string literals dominate the input rather than short keywords\"\n",
+    "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t    kbchk\n",
+    "/=]\n",
+};
+
+typedef struct {
+    size_t tokens;
+    uint64_t sum;
+    double seconds;
+} LexRun;
+
+int lex_next_ctype(Lexer* lx, Token* tok) {
+    const char* input = lx->input;
+    size_t len = lx->len;
+    size_t pos = lx->pos;
+    while (pos < len && isspace((unsigned char)input[pos])) pos++;
+    tok->start = pos;
+    tok->len = 0;
+    if (pos == len) {
+        lx->pos = pos;
+        tok->type = TOKEN_EOF;
+        return 0;
+    }
+    char c = input[pos];
+    if (c == '/' && len - pos >= 3) {
+        if (memcmp(&input[pos], "/+[", 3) == 0 || memcmp(&input[pos], "/=]", 3) == 0) {
+            tok->type = input[pos + 1] == '+' ? TOKEN_OP_BLOCK_START : TOKEN_OP_BLOCK_END;
+            tok->len = 3;
+            lx->pos = pos + 3;
+            return 1;
+        }
+    }
+    if (c == '"') {
+        tok->start = ++pos;
+        while (pos < len && input[pos] != '"') pos++;
+        tok->type = TOKEN_STRING;
+        tok->len = pos - tok->start;
+        if (pos < len) pos++;
+    } else if (isdigit((unsigned char)c)) {
+        while (pos < len && isdigit((unsigned char)input[pos])) pos++;
+        tok->type = TOKEN_NUMBER;
+        tok->len = pos - tok->start;
+    } else if (isalpha((unsigned char)c)) {
+        while (pos < len && isalpha((unsigned char)input[pos])) pos++;
+        tok->type = TOKEN_KEYWORD;
+        tok->len = pos - tok->start;
+    } else if (c == '=') {
+        tok->type = TOKEN_SYMBOL;
+        tok->len = 1;
+        pos++;
+    } else {
+        fprintf(stderr, "Lexing error at position %zu\n", pos);
+        exit(1);
+    }
+    lx->pos = pos;
+    return 1;
+}
+
+int generate(const char* path, size_t size, const char** lines, int n) {
+    FILE* f = fopen(path, "w");
+    if (!f) return 0;
+    size_t written = 0;
+    while (written < size) {
+        for (int i = 0; i < n; i++) {
+            written += fputs(lines[i], f) >= 0 ? strlen(lines[i]) : 0;
+        }
+    }
+    return fclose(f) == 0;
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+LexRun lex_run(Source* src, LexScanner* sc) {
+    LexRun r = { 0, 0, 0 };
+    Lexer lx;
+    Token tok;
+    double start = now();
+    lexer_init(&lx, src->data, src->len);
+    if (sc) {
+        lx.scan = sc->scan;
+        while (lex_next(&lx, &tok)) {
+            r.tokens++;
+            r.sum += tok.start * 31 + tok.len * 7 + tok.type;
+        }
+    } else {
+        while (lex_next_ctype(&lx, &tok)) {
+            r.tokens++;
+            r.sum += tok.start * 31 + tok.len * 7 + tok.type;
+        }
+    }
+    r.seconds = now() - start;
+    return r;
+}
+
+void load(size_t size, const char** lines, int n, Source* src) {
+    if (!generate(BENCH_FILE, size, lines, n) || !read_source(BENCH_FILE, src)) {
+        fprintf(stderr, "Error: Cannot write to %s\n", BENCH_FILE);
+        exit(1);
+    }
+    unlink(BENCH_FILE);
+}
+
+void report(const char* name, Source* src, LexRun r, double base) {
+    printf("  %-7s %zu bytes, %zu tokens in %.3f s (%.1f MB/s, %.1f Mtok/s, %.2fx)\n", name, src->len, r.tokens,
+        r.seconds, src->len / r.seconds / 1e6, r.tokens / r.seconds / 1e6, base / r.seconds);
+}
+
+int compare(const char* workload, Source* src) {
+    int failed = 0;
+    int n = sizeof(lex_scanners) / sizeof(lex_scanners[0]);
+    LexRun base = lex_run(src, NULL);
+    printf("%s:\n", workload);
+    report("ctype", src, base, base.seconds);
+    for (int i = 0; i < n; i++) {
+        if (!lex_scanner_supported(&lex_scanners[i])) continue;
+        LexRun r = lex_run(src, &lex_scanners[i]);
+        report(lex_scanners[i].name, src, r, base.seconds);
+        if (r.tokens != base.tokens || r.sum != base.sum) {
+            printf("FAIL: %s lexer produced a different token stream\n", lex_scanners[i].name);
+            failed = 1;
+        }
+    }
+    return failed;
+}
+
+int main() {
+    Source small;
+    Source large;
+    Source strings;
+    int nlines = sizeof(bench_lines) / sizeof(bench_lines[0]);
+    lexer_select();
+    load(BENCH_SMALL, bench_lines, nlines, &small);
+    load(BENCH_LARGE, bench_lines, nlines, &large);
+    load(BENCH_LARGE, bench_long_lines, sizeof(bench_long_lines) / sizeof(bench_long_lines[0]), &strings);
+    LexRun rs = lex_run(&small, lex_scanner);
+    LexRun rl = lex_run(&large, lex_scanner);
+    double ratio = (rl.seconds / large.len) / (rs.seconds / small.len);
+    int failed = compare("mixed", &large);
+    failed |= compare("long strings", &strings);
+    free_source(&small);
+    free_source(&large);
+    free_source(&strings);
+    if (ratio > 3) {
+        printf("FAIL: lexing is not linear (%.2fx slower per byte at 100 MB)\n", ratio);
+        return 1;
+    }
+    printf("%s: %s lexer, %.2fx per-byte cost at 100 MB vs 10 MB\n", failed ? "FAIL" : "OK", lex_scanner->name, ratio);
+    return failed;
+}
@@ -3,13 +3,61 @@
 #include <string.h>
 #include <ctype.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <limits.h>
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#define mkdir(path, mode) _mkdir(path)
+#define link(from, to) (-1)
+#else
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <spawn.h>
+extern char** environ;
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <linux/memfd.h>
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LEX_SIMD
+#include <immintrin.h>
+#endif
 
-#define MAX_TOKENS 1024
-#define MAX_AST 2048
-#define MAX_OUTPUT 4096
 #define MAX_BUFFER 4096
-#define MAX_PATH 256
-#define MAX_DEPS 16
+#define PROF_NAME_MAX 256
+#define MAX_REPORT 256
+#define MAX_SECTIONS 32
+#define OUT_CHUNK_SIZE 65536
+#define OUT_IOV_MAX 64
+#define ARENA_BLOCK_SIZE 65536
+#define LEX_SHORT_RUN 8
+#define PRINT_BUFFER 4096
+#define KEY_RING 16
+#define TERMIOS_SIZE 72
+#define TARGET_SIGINT 2
+#define TARGET_SIGTERM 15
+#define TARGET_SA_RESTORER 0x04000000
+#define ARENA_DEFAULT (1 << 20)
+#define ARENA_POPULATE 1
+#define ARENA_HUGE 2
+#define RUNTIME_SECTION ".n0rt."
+#define N0RYST_VERSION "1.09"
+#define CACHE_DIR ".n0ryst-cache"
+#define WATCH_SETTLE_MS 5
 
 enum TokenType {
     TOKEN_OP_BLOCK_START,
@@ -23,30 +71,83 @@ enum TokenType {
 
 typedef struct {
     enum TokenType type;
-    char value[256];
+    uint32_t len;
+    size_t start;
 } Token;
 
+enum CharClass {
+    CC_OTHER,
+    CC_SPACE,
+    CC_DIGIT,
+    CC_ALPHA,
+    CC_QUOTE,
+    CC_SLASH,
+    CC_EQUALS
+};
+
+typedef size_t (*LexScanFn)(const char* s, size_t pos, size_t len, int cls);
+
+typedef struct {
+    const char* name;
+    LexScanFn scan;
+} LexScanner;
+
+typedef struct {
+    const char* input;
+    size_t len;
+    size_t pos;
+    size_t base;
+    LexScanFn scan;
+} Lexer;
+
+enum Keyword {
+    KW_NONE,
+    KW_LET,
+    KW_PNT,
+    KW_KBCHK,
+    KW_LOOP
+};
+
+typedef struct {
+    const char* text;
+    uint32_t len;
+    enum Keyword keyword;
+} KeywordDef;
+
+typedef struct {
+    const char* data;
+    size_t len;
+    int mapped;
+} Source;
+
 enum ASTType {
     AST_BLOCK,
     AST_VARDECL,
+    AST_VARCOPY,
+    AST_VARSTR,
     AST_PRINT,
     AST_KBCHK,
+    AST_LOOP,
+    AST_LOOP_END,
     AST_END
 };
 
 typedef struct {
     enum ASTType type;
-    char value[256];
-    char value2[256];
+    uint32_t value;
+    uint32_t value2;
+    uint32_t pos;
 } ASTNode;
 
 typedef struct {
     char kernel[64];
-    char deps[MAX_DEPS][MAX_PATH];
+    const char** deps;
     int dep_count;
     char exit_key[8];
     char start[64];
-    char mem[16];
+    char mem[32];
+    long long arena_size;
+    int arena_hints;
     char level[16];
     char prompt[64];
 } Config;
@@ -57,527 +158,5601 @@ enum Platform {
     PLATFORM_LINUX,
     PLATFORM_WINDOWS,
     PLATFORM_IOS,
-    PLATFORM_ANDROID
+    PLATFORM_ANDROID,
+    PLATFORM_COUNT
+};
+
+enum Reg {
+    REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+    REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15
+};
+
+enum InsnOp {
+    INSN_LABEL,
+    INSN_SECTION,
+    INSN_MOV_RI,
+    INSN_MOV_RR,
+    INSN_MOV_RSYM,
+    INSN_LEA_RSYM,
+    INSN_STORE_MI,
+    INSN_STORE_MR,
+    INSN_LOAD_RM,
+    INSN_STORE8_SYM,
+    INSN_STORE8_MR,
+    INSN_LOAD8_SYM,
+    INSN_LOAD8_RM,
+    INSN_CMP_RI,
+    INSN_CMP8_RI,
+    INSN_TEST_RR,
+    INSN_XOR_RR,
+    INSN_ADD_RR,
+    INSN_SUB_RR,
+    INSN_CMP_RR,
+    INSN_OR_RR,
+    INSN_ADD_RI,
+    INSN_SUB_RI,
+    INSN_AND_RI,
+    INSN_SHL_RI,
+    INSN_DIV_R,
+    INSN_RDTSC,
+    INSN_REP_MOVSB,
+    INSN_JMP,
+    INSN_JE,
+    INSN_JZ,
+    INSN_JNZ,
+    INSN_JB,
+    INSN_JBE,
+    INSN_JLE,
+    INSN_CALL,
+    INSN_PUSH,
+    INSN_POP,
+    INSN_RET,
+    INSN_SYSCALL
+};
+
+typedef struct {
+    enum InsnOp op;
+    int reg;
+    int reg2;
+    long long imm;
+    int disp;
+    const char* sym;
+} Insn;
+
+enum IrOp {
+    IR_NOP,
+    IR_CONST,
+    IR_ADDR,
+    IR_COPY,
+    IR_STRING,
+    IR_MOVE,
+    IR_PRINT,
+    IR_KBCHK,
+    IR_LOOP,
+    IR_LOOP_END
+};
+
+typedef struct {
+    enum IrOp op;
+    int arg;
+    long long imm;
+    const char* sym;
+    int uses;
+    int end;
+    int reg;
+    int slot;
+    int next;
+    int phi;
+    int line;
+} IrInsn;
+
+typedef struct {
+    const char* section;
+    const char* name;
+    const char* bytes;
+    int len;
+} DataDef;
+
+typedef struct {
+    unsigned char* data;
+    size_t len;
+    size_t cap;
+} ByteBuf;
+
+typedef struct OutChunk {
+    struct OutChunk* next;
+    size_t len;
+    char data[OUT_CHUNK_SIZE];
+} OutChunk;
+
+typedef struct {
+    OutChunk* head;
+    OutChunk* tail;
+    size_t total;
+} OutBuf;
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t used;
+    size_t cap;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* head;
+    ArenaBlock* cur;
+} Arena;
+
+typedef struct {
+    const char* str;
+    size_t len;
+    uint64_t hash;
+} StrEntry;
+
+typedef struct {
+    StrEntry* entries;
+    int count;
+    int cap;
+    uint32_t* slots;
+    size_t slot_cap;
+} StrTab;
+
+enum Phase {
+    PHASE_READ,
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_CODEGEN,
+    PHASE_ASSEMBLE,
+    PHASE_LINK,
+    PHASE_COUNT
+};
+
+typedef struct {
+    const char* name;
+    const char* cat;
+    const char* unit;
+    int tid;
+    double start;
+    double end;
+} TraceSpan;
+
+typedef struct {
+    TraceSpan* spans;
+    int count;
+    int cap;
+} Trace;
+
+typedef struct Backend Backend;
+
+typedef struct CompileUnit {
+    const char* path;
+    int is_main;
+    const Backend* backend;
+    struct CompileUnit* front;
+    struct CompileUnit* variant;
+    char* asm_path;
+    char* obj_path;
+    const char* src;
+    int project;
+    Config* config;
+    Source source;
+    size_t bytes;
+    uint64_t key;
+    uint64_t obj_hash;
+    int unchanged;
+    Token* tokens;
+    int token_count;
+    int token_cap;
+    ASTNode* ast;
+    int ast_count;
+    int ast_cap;
+    Arena arena;
+    StrTab strs;
+    OutBuf out;
+    IrInsn* ir;
+    int ir_count;
+    Insn* insns;
+    int insn_count;
+    int insn_cap;
+    DataDef* data;
+    int data_count;
+    int data_cap;
+    const char** externs;
+    int extern_count;
+    int extern_cap;
+    const char** globals;
+    int global_count;
+    int global_cap;
+    char* log;
+    int log_pos;
+    int log_cap;
+    int status;
+    int cache_hit;
+    int worker;
+    int asm_pending;
+    int asm_fd;
+    pid_t tool;
+    double asm_start;
+    double tool_start;
+    double phase_time[PHASE_COUNT];
+    Trace trace;
+} CompileUnit;
+
+struct Backend {
+    enum Platform platform;
+    const char* name;
+    const char* nasm_format;
+    const char* entry;
+    int elf;
+    int builtin_link;
+    int shadow_space;
+    int carry_errors;
+    long long sys_read;
+    long long sys_write;
+    long long sys_exit;
+    long long sys_ioctl;
+    long long sys_poll;
+    long long sys_mmap;
+    long long sys_madvise;
+    long long sys_sigaction;
+    long long sys_sigreturn;
+    long long sys_clock_gettime;
+    long long sys_clock_nanosleep;
+    long long clock_monotonic;
+    long long tcgets;
+    long long tcsets;
+    int lflag_offset;
+    long long lflag_raw;
+    long long map_anon;
+    long long map_populate;
+    long long map_huge;
+    int tick_absolute;
+    const char* tick_extern;
+    const char* alloc_extern;
+    const char* exit_extern;
+    const char* const* ld_args;
+    const char* ld_out;
+    const char* exe_suffix;
+    const char* const* ld_main_libs;
+    const char* const* ld_libs;
+    void (*declare_io)(CompileUnit* u);
+    void (*emit_write_all)(CompileUnit* u);
+    void (*emit_kbhit)(CompileUnit* u);
+    void (*emit_tty)(CompileUnit* u);
+    void (*emit_tick)(CompileUnit* u);
+    void (*emit_loop_wait)(CompileUnit* u, long long period);
+    void (*emit_arena_init)(CompileUnit* u);
+    void (*emit_arena_fail)(CompileUnit* u, long long msg_len);
+    void (*emit_write_err)(CompileUnit* u);
+    void (*emit_exit)(CompileUnit* u);
+};
+
+typedef struct {
+    Arena arena;
+    StrTab paths;
+    uint32_t* edges;
+    int edge_count;
+    int edge_cap;
+    const char** deps;
+    int* unit;
+    const char* noi;
+    const char* main;
+} ProjectIndex;
+
+typedef struct {
+    char* dir;
+    const char* nrs_path;
+    char* exe_path;
+    ProjectIndex index;
+    Config config;
+    const Backend* backend;
+    CompileUnit* units;
+    int unit_count;
+    int pending;
+    int status;
+    double link_time;
+    char log[MAX_REPORT];
+    Trace trace;
+} Project;
+
+typedef struct {
+    int head;
+    int tail;
+    pthread_mutex_t lock;
+} TaskDeque;
+
+typedef struct {
+    Project* projects;
+    CompileUnit** tasks;
+    TaskDeque* deques;
+    int workers;
+    int started;
+    int link;
+    pthread_mutex_t lock;
+} Scheduler;
+
+#define CONFIG_DEFAULTS { .kernel = "n0ryst", .dep_count = 0, .exit_key = "q", .arena_size = ARENA_DEFAULT }
+
+int target_list[PLATFORM_COUNT];
+int target_count = 0;
+int use_cache = 1;
+int show_cache_stats = 0;
+int emit_asm = 0;
+int opt_level = 0;
+int time_report = 0;
+const char* trace_path = NULL;
+int watch_mode = 0;
+int recover_errors = 0;
+int stream_mode = 0;
+int stdin_main = 0;
+int job_limit = 0;
+int spawn_slots = 0;
+pthread_mutex_t spawn_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t spawn_cond = PTHREAD_COND_INITIALIZER;
+volatile sig_atomic_t watch_stop = 0;
+_Thread_local jmp_buf* fail_jump = NULL;
+double build_start;
+Trace main_trace;
+
+const char* phase_names[PHASE_COUNT] = { "read", "lex", "parse", "codegen", "assemble", "link" };
+const char* phase_logs[PHASE_COUNT] = { "[Reading]", "[Lexing]", "[Parsing]", "[Codegen]", "[Assembling]", "[Linking]" };
+
+const unsigned char char_class[256] = {
+    ['\t'] = CC_SPACE, ['\n'] = CC_SPACE, ['\v'] = CC_SPACE, ['\f'] = CC_SPACE, ['\r'] = CC_SPACE, [' '] = CC_SPACE,
+    ['0' ... '9'] = CC_DIGIT, ['A' ... 'Z'] = CC_ALPHA, ['a' ... 'z'] = CC_ALPHA,
+    ['"'] = CC_QUOTE, ['/'] = CC_SLASH, ['='] = CC_EQUALS
 };
 
-Token tokens[MAX_TOKENS];
-ASTNode ast[MAX_AST];
-char output_buf[MAX_OUTPUT];
-int token_count = 0;
-int ast_count = 0;
-int output_pos = 0;
-Config config = { .kernel = "n0ryst", .dep_count = 0, .exit_key = "q" };
-enum Platform target_platform = PLATFORM_MACOS;
+const KeywordDef keywords[8] = {
+    [0] = { "loop", 4, KW_LOOP },
+    [3] = { "pnt", 3, KW_PNT },
+    [6] = { "kbchk", 5, KW_KBCHK },
+    [7] = { "let", 3, KW_LET }
+};
 
 void n0ryst_log(const char* msg) {
     printf("%s\n", msg);
 }
 
-char* read_file(const char* path) {
-    FILE* file = fopen(path, "r");
-    if (!file) {
-        fprintf(stderr, "Error: Cannot open file %s\n", path);
+void unit_log(CompileUnit* u, const char* msg) {
+    int len = strlen(msg);
+    if (u->log_pos + len + 1 > u->log_cap) {
+        while (u->log_pos + len + 1 > u->log_cap) u->log_cap = u->log_cap ? u->log_cap * 2 : 1024;
+        u->log = realloc(u->log, u->log_cap);
+        if (!u->log) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(&u->log[u->log_pos], msg, len);
+    u->log_pos += len;
+    u->log[u->log_pos++] = '\n';
+}
+
+double mono_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+__attribute__((noreturn))
+void fail() {
+    if (fail_jump) longjmp(*fail_jump, 1);
+    exit(1);
+}
+
+void* xrealloc(void* ptr, size_t size) {
+    void* p = realloc(ptr, size);
+    if (!p) {
+        fprintf(stderr, "Error: Out of memory\n");
         exit(1);
     }
-    char* buffer = malloc(MAX_BUFFER);
-    size_t len = fread(buffer, 1, MAX_BUFFER - 1, file);
-    buffer[len] = '\0';
-    fclose(file);
-    return buffer;
+    return p;
 }
 
-void read_noi(const char* dir) {
-    DIR* d = opendir(dir);
-    if (!d) return;
-    struct dirent* entry;
-    char noi_path[MAX_PATH];
-    while ((entry = readdir(d))) {
-        if (strstr(entry->d_name, ".noi")) {
-            snprintf(noi_path, MAX_PATH, "%s/%s", dir, entry->d_name);
-            FILE* file = fopen(noi_path, "r");
-            if (!file) continue;
-            char line[256];
-            while (fgets(line, sizeof(line), file)) {
-                line[strcspn(line, "\n")] = '\0';
-                if (strncmp(line, "kernel:", 7) == 0) {
-                    char* val = strchr(line + 7, ':') ? line + 8 : line + 7;
-                    while (isspace(*val)) val++;
-                    strncpy(config.kernel, val, 63);
-                } else if (strncmp(line, "deps:", 5) == 0) {
-                    char* val = strchr(line + 5, ':') ? line + 6 : line + 5;
-                    while (isspace(*val)) val++;
-                    char* token = strtok(val, ",");
-                    while (token && config.dep_count < MAX_DEPS) {
-                        while (isspace(*token)) token++;
-                        snprintf(config.deps[config.dep_count], MAX_PATH, "%s/%s", dir, token);
-                        config.dep_count++;
-                        token = strtok(NULL, ",");
-                    }
-                } else if (strncmp(line, "exit_key:", 9) == 0) {
-                    char* key = strchr(line + 9, '"');
-                    if (key) {
-                        strncpy(config.exit_key, key + 1, 7);
-                        config.exit_key[strcspn(config.exit_key, "\"")] = '\0';
-                    }
-                } else if (strncmp(line, "start:", 6) == 0) {
-                    char* val = strchr(line + 6, ':') ? line + 7 : line + 6;
-                    while (isspace(*val)) val++;
-                    strncpy(config.start, val, 63);
-                } else if (strncmp(line, "mem:", 4) == 0) {
-                    char* val = strchr(line + 4, ':') ? line + 5 : line + 4;
-                    while (isspace(*val)) val++;
-                    strncpy(config.mem, val, 15);
-                } else if (strncmp(line, "level:", 6) == 0) {
-                    char* val = strchr(line + 6, ':') ? line + 7 : line + 6;
-                    while (isspace(*val)) val++;
-                    strncpy(config.level, val, 15);
-                } else if (strncmp(line, "prompt:", 7) == 0) {
-                    char* val = strchr(line + 7, '"');
-                    if (val) {
-                        strncpy(config.prompt, val + 1, 63);
-                        config.prompt[strcspn(config.prompt, "\"")] = '\0';
-                    }
-                }
-            }
-            fclose(file);
-            break;
-        }
+char* str_printf(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    char* str = xrealloc(NULL, len + 1);
+    va_start(ap, fmt);
+    vsnprintf(str, len + 1, fmt, ap);
+    va_end(ap);
+    return str;
+}
+
+int read_line(FILE* f, char** line, size_t* cap) {
+    size_t len = 0;
+    if (!*cap) {
+        *cap = 256;
+        *line = xrealloc(NULL, *cap);
     }
-    closedir(d);
+    while (fgets(*line + len, *cap - len, f)) {
+        len += strlen(*line + len);
+        if (len && (*line)[len - 1] == '\n') return 1;
+        if (len + 1 < *cap) return 1;
+        *cap *= 2;
+        *line = xrealloc(*line, *cap);
+    }
+    return len > 0;
 }
 
-int find_nrs(const char* dir, char* nrs_path) {
-    DIR* d = opendir(dir);
-    if (!d) {
-        fprintf(stderr, "Error: Cannot open directory %s\n", dir);
+void trace_span(Trace* t, const char* name, const char* cat, const char* unit, int tid, double start, double end) {
+    if (!trace_path) return;
+    if (t->count == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 16;
+        t->spans = xrealloc(t->spans, t->cap * sizeof(TraceSpan));
+    }
+    t->spans[t->count++] = (TraceSpan){ name, cat, unit, tid, start, end };
+}
+
+void unit_phase(CompileUnit* u, enum Phase phase, double start) {
+    double end = mono_time();
+    char msg[64];
+    u->phase_time[phase] += end - start;
+    trace_span(&u->trace, phase_names[phase], "phase", u->path, u->worker, start, end);
+    snprintf(msg, sizeof(msg), "%s %.3f ms", phase_logs[phase], (end - start) * 1e3);
+    unit_log(u, msg);
+}
+
+uint64_t hash_bytes(uint64_t h, const void* data, size_t len) {
+    const unsigned char* p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+void* arena_alloc(Arena* a, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    while (a->cur && a->cur->used + size > a->cur->cap && a->cur->next) {
+        a->cur = a->cur->next;
+        a->cur->used = 0;
+    }
+    if (!a->cur || a->cur->used + size > a->cur->cap) {
+        size_t cap = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        ArenaBlock* b = xrealloc(NULL, sizeof(ArenaBlock) + cap);
+        b->next = NULL;
+        b->used = 0;
+        b->cap = cap;
+        if (a->cur) a->cur->next = b;
+        else a->head = b;
+        a->cur = b;
+    }
+    void* p = a->cur->data + a->cur->used;
+    a->cur->used += size;
+    return p;
+}
+
+void arena_reset(Arena* a) {
+    a->cur = a->head;
+    if (a->cur) a->cur->used = 0;
+}
+
+void arena_free(Arena* a) {
+    while (a->head) {
+        ArenaBlock* next = a->head->next;
+        free(a->head);
+        a->head = next;
+    }
+    a->cur = NULL;
+}
+
+void strtab_rehash(StrTab* t) {
+    t->slot_cap = t->slot_cap ? t->slot_cap * 2 : 256;
+    free(t->slots);
+    t->slots = calloc(t->slot_cap, sizeof(uint32_t));
+    if (!t->slots) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    size_t mask = t->slot_cap - 1;
+    for (int id = 1; id < t->count; id++) {
+        size_t i = t->entries[id].hash & mask;
+        while (t->slots[i]) i = (i + 1) & mask;
+        t->slots[i] = id;
+    }
+}
+
+void strtab_reset(StrTab* t) {
+    if (!t->cap) {
+        t->cap = 64;
+        t->entries = xrealloc(NULL, t->cap * sizeof(StrEntry));
+        t->entries[0] = (StrEntry){ "", 0, 0 };
+    }
+    t->count = 1;
+    if (t->slots) memset(t->slots, 0, t->slot_cap * sizeof(uint32_t));
+}
+
+void strtab_free(StrTab* t) {
+    free(t->entries);
+    free(t->slots);
+}
+
+uint32_t intern(Arena* a, StrTab* t, const char* s, size_t len) {
+    if (!len) return 0;
+    if ((size_t)t->count * 2 >= t->slot_cap) strtab_rehash(t);
+    uint64_t h = hash_bytes(0xcbf29ce484222325ULL, s, len);
+    size_t mask = t->slot_cap - 1;
+    size_t i = h & mask;
+    for (; t->slots[i]; i = (i + 1) & mask) {
+        StrEntry* e = &t->entries[t->slots[i]];
+        if (e->hash == h && e->len == len && memcmp(e->str, s, len) == 0) return t->slots[i];
+    }
+    if (t->count == t->cap) {
+        t->cap *= 2;
+        t->entries = xrealloc(t->entries, t->cap * sizeof(StrEntry));
+    }
+    char* str = arena_alloc(a, len + 1);
+    memcpy(str, s, len);
+    str[len] = '\0';
+    t->entries[t->count] = (StrEntry){ str, len, h };
+    t->slots[i] = t->count;
+    return t->count++;
+}
+
+uint32_t strtab_find(StrTab* t, const char* s, size_t len) {
+    if (!len || !t->slot_cap) return 0;
+    uint64_t h = hash_bytes(0xcbf29ce484222325ULL, s, len);
+    size_t mask = t->slot_cap - 1;
+    for (size_t i = h & mask; t->slots[i]; i = (i + 1) & mask) {
+        StrEntry* e = &t->entries[t->slots[i]];
+        if (e->hash == h && e->len == len && memcmp(e->str, s, len) == 0) return t->slots[i];
+    }
+    return 0;
+}
+
+int read_source(const char* path, Source* src) {
+    int fd = strcmp(path, "-") == 0 ? dup(STDIN_FILENO) : open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open file %s\n", path);
         return 0;
     }
-    struct dirent* entry;
-    while ((entry = readdir(d))) {
-        if (strstr(entry->d_name, ".nrs")) {
-            char candidate[MAX_PATH];
-            snprintf(candidate, MAX_PATH, "%s/%s", dir, entry->d_name);
-            int is_dep = 0;
-            for (int i = 0; i < config.dep_count; i++) {
-                if (strcmp(candidate, config.deps[i]) == 0) {
-                    is_dep = 1;
-                    break;
-                }
-            }
-            if (!is_dep) {
-                strcpy(nrs_path, candidate);
-                closedir(d);
-                return 1;
-            }
+    src->data = NULL;
+    src->len = 0;
+    src->mapped = 0;
+    struct stat st;
+#ifndef _WIN32
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            src->data = p;
+            src->len = st.st_size;
+            src->mapped = 1;
+            return 1;
         }
     }
-    closedir(d);
-    fprintf(stderr, "Error: No main .nrs file found in %s\n", dir);
-    return 0;
+#endif
+    size_t cap = fstat(fd, &st) == 0 && st.st_size > 0 ? (size_t)st.st_size + 1 : MAX_BUFFER;
+    char* buf = xrealloc(NULL, cap);
+    for (;;) {
+        if (src->len == cap) {
+            cap *= 2;
+            buf = xrealloc(buf, cap);
+        }
+        ssize_t n = read(fd, buf + src->len, cap - src->len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            fprintf(stderr, "Error: Cannot read file %s\n", path);
+            free(buf);
+            close(fd);
+            return 0;
+        }
+        if (n == 0) break;
+        src->len += n;
+    }
+    close(fd);
+    src->data = buf;
+    return 1;
 }
 
-void lexer(const char* input) {
-    int pos = 0;
-    while (input[pos] && token_count < MAX_TOKENS) {
-        if (isspace(input[pos])) {
-            pos++;
-            continue;
+void free_source(Source* src) {
+#ifndef _WIN32
+    if (src->mapped) {
+        munmap((void*)src->data, src->len);
+        return;
+    }
+#endif
+    free((void*)src->data);
+}
+
+int parse_mem(Config* c, const char* val) {
+    char* end;
+    long long size = strtoll(val, &end, 10);
+    int shift = *end == 'K' || *end == 'k' ? 10 : *end == 'M' || *end == 'm' ? 20 : *end == 'G' || *end == 'g' ? 30 : 0;
+    if (shift) end++;
+    if (size <= 0 || size > (1LL << (40 - shift))) {
+        fprintf(stderr, "Error: Invalid mem size %s\n", val);
+        return 0;
+    }
+    c->arena_size = size << shift;
+    c->arena_hints = 0;
+    while (*end) {
+        while (isspace(*end)) end++;
+        size_t len = strcspn(end, " \t");
+        if (len == 8 && strncmp(end, "populate", 8) == 0) {
+            c->arena_hints |= ARENA_POPULATE;
+        } else if (len == 4 && strncmp(end, "huge", 4) == 0) {
+            c->arena_hints |= ARENA_HUGE;
+        } else if (len) {
+            fprintf(stderr, "Error: Unknown mem option %.*s\n", (int)len, end);
+            return 0;
         }
-        if (input[pos] == '/') {
-            if (pos + 2 < strlen(input)) {
-                if (strncmp(&input[pos], "/+[", 3) == 0) {
-                    tokens[token_count].type = TOKEN_OP_BLOCK_START;
-                    strcpy(tokens[token_count].value, "/+[");
-                    token_count++;
-                    pos += 3;
-                    continue;
-                } else if (strncmp(&input[pos], "/=]", 3) == 0) {
-                    tokens[token_count].type = TOKEN_OP_BLOCK_END;
-                    strcpy(tokens[token_count].value, "/=]");
-                    token_count++;
-                    pos += 3;
-                    continue;
-                }
-            }
+        end += len;
+    }
+    return 1;
+}
+
+int has_suffix(const char* name, const char* suffix) {
+    size_t len = strlen(name);
+    size_t n = strlen(suffix);
+    return len > n && strcmp(name + len - n, suffix) == 0;
+}
+
+const char* index_str(ProjectIndex* x, const char* s, size_t len) {
+    uint32_t id = intern(&x->arena, &x->paths, s, len);
+    return x->paths.entries[id].str;
+}
+
+uint32_t index_path(ProjectIndex* x, const char* dir, const char* name, size_t len) {
+    char* path = str_printf("%s/%.*s", dir, (int)len, name);
+    uint32_t id = intern(&x->arena, &x->paths, path, strlen(path));
+    free(path);
+    return id;
+}
+
+void index_deps(ProjectIndex* x, uint32_t from, const char* dir, const char* list) {
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        const char* name = list;
+        list += len;
+        if (*list == ',') list++;
+        while (len && isspace((unsigned char)*name)) name++, len--;
+        while (len && isspace((unsigned char)name[len - 1])) len--;
+        if (!len) continue;
+        if (x->edge_count == x->edge_cap) {
+            x->edge_cap = x->edge_cap ? x->edge_cap * 2 : 64;
+            x->edges = xrealloc(x->edges, 2 * x->edge_cap * sizeof(uint32_t));
         }
-        if (input[pos] == '"') {
-            pos++;
-            int i = 0;
-            while (input[pos] && input[pos] != '"' && i < 255) {
-                tokens[token_count].value[i++] = input[pos++];
+        x->edges[2 * x->edge_count] = from;
+        x->edges[2 * x->edge_count + 1] = index_path(x, dir, name, len);
+        x->edge_count++;
+    }
+}
+
+void index_units(ProjectIndex* x, Config* c) {
+    x->unit = xrealloc(NULL, x->paths.count * sizeof(int));
+    for (int i = 0; i < x->paths.count; i++) x->unit[i] = -1;
+    for (int i = 0; i < c->dep_count; i++) x->unit[strtab_find(&x->paths, c->deps[i], strlen(c->deps[i]))] = i;
+}
+
+int index_unit(ProjectIndex* x, const char* path) {
+    uint32_t id = strtab_find(&x->paths, path, strlen(path));
+    return id && x->unit ? x->unit[id] : -1;
+}
+
+void free_index(ProjectIndex* x) {
+    arena_free(&x->arena);
+    strtab_free(&x->paths);
+    free(x->edges);
+    free(x->deps);
+    free(x->unit);
+    *x = (ProjectIndex){0};
+}
+
+int read_noi(Config* c, ProjectIndex* x, const char* dir, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return 1;
+    int ok = 1;
+    char* line = NULL;
+    size_t cap = 0;
+    while (read_line(file, &line, &cap)) {
+        line[strcspn(line, "\n")] = '\0';
+        size_t key = strcspn(line, ":");
+        if (strncmp(line, "kernel:", 7) == 0) {
+            char* val = strchr(line + 7, ':') ? line + 8 : line + 7;
+            while (isspace(*val)) val++;
+            strncpy(c->kernel, val, 63);
+        } else if (strncmp(line, "deps:", 5) == 0) {
+            char* val = strchr(line + 5, ':') ? line + 6 : line + 5;
+            if (x) index_deps(x, 0, dir, val);
+        } else if (strncmp(line, "exit_key:", 9) == 0) {
+            char* key = strchr(line + 9, '"');
+            if (key) {
+                strncpy(c->exit_key, key + 1, 7);
+                c->exit_key[strcspn(c->exit_key, "\"")] = '\0';
             }
-            tokens[token_count].value[i] = '\0';
-            tokens[token_count].type = TOKEN_STRING;
-            token_count++;
-            if (input[pos] == '"') pos++;
-            continue;
-        }
-        if (isdigit(input[pos])) {
-            int i = 0;
-            while (isdigit(input[pos]) && i < 255) {
-                tokens[token_count].value[i++] = input[pos++];
+        } else if (strncmp(line, "start:", 6) == 0) {
+            char* val = strchr(line + 6, ':') ? line + 7 : line + 6;
+            while (isspace(*val)) val++;
+            strncpy(c->start, val, 63);
+        } else if (strncmp(line, "mem:", 4) == 0) {
+            char* val = strchr(line + 4, ':') ? line + 5 : line + 4;
+            while (isspace(*val)) val++;
+            strncpy(c->mem, val, 31);
+            ok &= parse_mem(c, val);
+        } else if (strncmp(line, "level:", 6) == 0) {
+            char* val = strchr(line + 6, ':') ? line + 7 : line + 6;
+            while (isspace(*val)) val++;
+            strncpy(c->level, val, 15);
+        } else if (strncmp(line, "prompt:", 7) == 0) {
+            char* val = strchr(line + 7, '"');
+            if (val) {
+                strncpy(c->prompt, val + 1, 63);
+                c->prompt[strcspn(c->prompt, "\"")] = '\0';
             }
-            tokens[token_count].value[i] = '\0';
-            tokens[token_count].type = TOKEN_NUMBER;
-            token_count++;
-            continue;
+        } else if (x && line[key] == ':' && key > 4 && strncmp(line + key - 4, ".nrs", 4) == 0) {
+            index_deps(x, index_path(x, dir, line, key), dir, line + key + 1);
         }
-        if (isalpha(input[pos])) {
-            int i = 0;
-            while (isalpha(input[pos]) && i < 255) {
-                tokens[token_count].value[i++] = input[pos++];
-            }
-            tokens[token_count].value[i] = '\0';
-            tokens[token_count].type = TOKEN_KEYWORD;
-            token_count++;
+    }
+    free(line);
+    fclose(file);
+    return ok;
+}
+
+int sort_deps(ProjectIndex* x, Config* c) {
+    int n = x->paths.count;
+    int* first = calloc(n + 1, sizeof(int));
+    int* next = malloc(n * sizeof(int));
+    int* stack = malloc(n * sizeof(int));
+    char* state = calloc(n, 1);
+    uint32_t* adj = malloc((x->edge_count + 1) * sizeof(uint32_t));
+    if (!first || !next || !stack || !state || !adj) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    for (int e = 0; e < x->edge_count; e++) first[x->edges[2 * e] + 1]++;
+    for (int i = 0; i < n; i++) first[i + 1] += first[i];
+    memcpy(next, first, n * sizeof(int));
+    for (int e = 0; e < x->edge_count; e++) adj[next[x->edges[2 * e]]++] = x->edges[2 * e + 1];
+    x->deps = xrealloc(NULL, n * sizeof(const char*));
+    c->deps = x->deps;
+    c->dep_count = 0;
+    memcpy(next, first, n * sizeof(int));
+    int ok = 1;
+    int top = 0;
+    stack[0] = 0;
+    state[0] = 1;
+    while (top >= 0 && ok) {
+        int id = stack[top];
+        if (next[id] == first[id + 1]) {
+            state[id] = 2;
+            if (id) x->deps[c->dep_count++] = x->paths.entries[id].str;
+            top--;
             continue;
         }
-        if (input[pos] == '=') {
-            tokens[token_count].type = TOKEN_SYMBOL;
-            tokens[token_count].value[0] = '=';
-            tokens[token_count].value[1] = '\0';
-            token_count++;
-            pos++;
-            continue;
+        uint32_t to = adj[next[id]++];
+        if (state[to] == 1) {
+            fprintf(stderr, "Error: Dependency cycle at %s\n", x->paths.entries[to].str);
+            ok = 0;
+        } else if (!state[to]) {
+            state[to] = 1;
+            stack[++top] = to;
         }
-        fprintf(stderr, "Lexing error at position %d, character '%c' (ASCII %d)\n", pos, input[pos], input[pos]);
-        exit(1);
     }
-    tokens[token_count].type = TOKEN_EOF;
-    tokens[token_count].value[0] = '\0';
-    token_count++;
+    free(first);
+    free(next);
+    free(stack);
+    free(state);
+    free(adj);
+    return ok;
 }
 
-void parser() {
-    int token_pos = 0;
-    while (ast_count < MAX_AST) {
-        if (tokens[token_pos].type == TOKEN_EOF) {
-            ast[ast_count].type = AST_END;
-            ast_count++;
-            break;
-        }
-        if (tokens[token_pos].type == TOKEN_OP_BLOCK_START) {
-            token_pos++;
-            ast[ast_count].type = AST_BLOCK;
-            ast_count++;
-            while (tokens[token_pos].type != TOKEN_OP_BLOCK_END) {
-                if (tokens[token_pos].type == TOKEN_KEYWORD) {
-                    if (strcmp(tokens[token_pos].value, "let") == 0) {
-                        token_pos++;
-                        ast[ast_count].type = AST_VARDECL;
-                        strcpy(ast[ast_count].value, tokens[token_pos].value);
-                        token_pos++;
-                        if (tokens[token_pos].type == TOKEN_SYMBOL && tokens[token_pos].value[0] == '=') {
-                            token_pos++;
-                            strcpy(ast[ast_count].value2, tokens[token_pos].value);
-                            token_pos++;
-                        } else {
-                            ast[ast_count].value2[0] = '\0';
-                        }
-                        ast_count++;
-                    } else if (strcmp(tokens[token_pos].value, "pnt") == 0) {
-                        token_pos++;
-                        ast[ast_count].type = AST_PRINT;
-                        strcpy(ast[ast_count].value, tokens[token_pos].value);
-                        token_pos++;
-                        ast_count++;
-                    } else if (strcmp(tokens[token_pos].value, "kbchk") == 0) {
-                        token_pos++;
-                        ast[ast_count].type = AST_KBCHK;
-                        ast_count++;
-                    } else {
-                        fprintf(stderr, "Parsing error: unknown keyword %s\n", tokens[token_pos].value);
-                        exit(1);
-                    }
-                } else {
-                    fprintf(stderr, "Parsing error at token %d\n", token_pos);
-                    exit(1);
-                }
+int path_stamp(const char* path, long long stamp[3]) {
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+    stamp[0] = st.st_mtime;
+#if defined(__APPLE__)
+    stamp[1] = st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    stamp[1] = 0;
+#else
+    stamp[1] = st.st_mtim.tv_nsec;
+#endif
+    stamp[2] = st.st_size;
+    return 1;
+}
+
+int write_stamp(FILE* f, const char* path) {
+    long long stamp[3];
+    if (!path_stamp(path, stamp)) return 0;
+    fprintf(f, "stamp %lld %lld %lld %s\n", stamp[0], stamp[1], stamp[2], path);
+    return 1;
+}
+
+void manifest_path(char* path, size_t size, const char* dir) {
+    uint64_t h = hash_bytes(0xcbf29ce484222325ULL, dir, strlen(dir));
+    snprintf(path, size, "%s/%016llx.idx", CACHE_DIR, (unsigned long long)h);
+}
+
+void store_manifest(Project* p) {
+    ProjectIndex* x = &p->index;
+    char path[64];
+    manifest_path(path, sizeof(path), p->dir);
+    mkdir(CACHE_DIR, 0755);
+    char* tmp_path = str_printf("%s.%ld.tmp", path, (long)getpid());
+    FILE* f = fopen(tmp_path, "w");
+    if (!f) {
+        free(tmp_path);
+        return;
+    }
+    fprintf(f, "n0ryst-index %s\ndir %s\n", N0RYST_VERSION, p->dir);
+    StrTab dirs = {0};
+    strtab_reset(&dirs);
+    intern(&x->arena, &dirs, p->dir, strlen(p->dir));
+    int ok = write_stamp(f, p->dir) && (!x->noi || write_stamp(f, x->noi));
+    for (int i = 0; i < p->config.dep_count && ok; i++) {
+        const char* dep = p->config.deps[i];
+        int count = dirs.count;
+        uint32_t id = intern(&x->arena, &dirs, dep, strrchr(dep, '/') - dep);
+        if ((int)id >= count) ok = write_stamp(f, dirs.entries[id].str);
+    }
+    strtab_free(&dirs);
+    if (x->noi) fprintf(f, "noi %s\n", x->noi);
+    fprintf(f, "main %s\n", x->main);
+    for (int i = 0; i < p->config.dep_count; i++) fprintf(f, "dep %s\n", p->config.deps[i]);
+    if (fclose(f) != 0 || !ok || rename(tmp_path, path) != 0) unlink(tmp_path);
+    free(tmp_path);
+}
+
+int load_manifest(Project* p) {
+    if (!use_cache || stdin_main) return 0;
+    ProjectIndex* x = &p->index;
+    Config* c = &p->config;
+    char path[64];
+    manifest_path(path, sizeof(path), p->dir);
+    FILE* f = fopen(path, "r");
+    if (!f) return 0;
+    char* line = NULL;
+    size_t cap = 0;
+    int dep_cap = 0;
+    int ok = read_line(f, &line, &cap) && strcmp(line, "n0ryst-index " N0RYST_VERSION "\n") == 0;
+    while (ok && read_line(f, &line, &cap)) {
+        size_t len = strcspn(line, "\n");
+        line[len] = '\0';
+        if (strncmp(line, "dir ", 4) == 0) {
+            ok = strcmp(line + 4, p->dir) == 0;
+        } else if (strncmp(line, "stamp ", 6) == 0) {
+            long long want[3];
+            long long have[3];
+            int pos = 0;
+            ok = sscanf(line + 6, "%lld %lld %lld %n", &want[0], &want[1], &want[2], &pos) == 3 && pos &&
+                path_stamp(line + 6 + pos, have) && memcmp(want, have, sizeof(want)) == 0;
+        } else if (strncmp(line, "noi ", 4) == 0) {
+            x->noi = index_str(x, line + 4, len - 4);
+        } else if (strncmp(line, "main ", 5) == 0) {
+            x->main = index_str(x, line + 5, len - 5);
+        } else if (strncmp(line, "dep ", 4) == 0) {
+            if (c->dep_count == dep_cap) {
+                dep_cap = dep_cap ? dep_cap * 2 : 16;
+                x->deps = xrealloc(x->deps, dep_cap * sizeof(const char*));
             }
-            token_pos++;
+            x->deps[c->dep_count++] = index_str(x, line + 4, len - 4);
         } else {
-            fprintf(stderr, "Parsing error: expected block start\n");
-            exit(1);
+            ok = 0;
         }
     }
+    free(line);
+    fclose(f);
+    if (!ok || !x->main) {
+        free_index(x);
+        strtab_reset(&x->paths);
+        c->dep_count = 0;
+        return 0;
+    }
+    c->deps = x->deps;
+    index_units(x, c);
+    x->unit[strtab_find(&x->paths, x->main, strlen(x->main))] = c->dep_count;
+    return 1;
 }
 
-void append_str(const char* str) {
-    int len = strlen(str);
-    if (output_pos + len < MAX_OUTPUT) {
-        strcpy(&output_buf[output_pos], str);
-        output_pos += len;
+int scan_project(Project* p) {
+    ProjectIndex* x = &p->index;
+    DIR* d = opendir(p->dir);
+    if (!d) {
+        fprintf(stderr, "Error: Cannot open directory %s\n", p->dir);
+        return 0;
+    }
+    char* noi = NULL;
+    uint32_t* sources = NULL;
+    int source_count = 0;
+    int source_cap = 0;
+    struct dirent* entry;
+    while ((entry = readdir(d))) {
+        if (has_suffix(entry->d_name, ".noi")) {
+            if (noi && strcmp(entry->d_name, noi) >= 0) continue;
+            free(noi);
+            noi = str_printf("%s", entry->d_name);
+        } else if (has_suffix(entry->d_name, ".nrs")) {
+            if (source_count == source_cap) {
+                source_cap = source_cap ? source_cap * 2 : 16;
+                sources = xrealloc(sources, source_cap * sizeof(uint32_t));
+            }
+            sources[source_count++] = index_path(x, p->dir, entry->d_name, strlen(entry->d_name));
+        }
+    }
+    closedir(d);
+    int ok = 1;
+    if (noi) {
+        uint32_t id = index_path(x, p->dir, noi, strlen(noi));
+        x->noi = x->paths.entries[id].str;
+        ok = read_noi(&p->config, x, p->dir, x->noi);
+        free(noi);
     }
+    ok = ok && sort_deps(x, &p->config);
+    if (ok) {
+        index_units(x, &p->config);
+        uint32_t main_id = 0;
+        for (int i = 0; i < source_count; i++) {
+            uint32_t id = sources[i];
+            if (x->unit[id] >= 0) continue;
+            if (!main_id || strcmp(x->paths.entries[id].str, x->paths.entries[main_id].str) < 0) main_id = id;
+        }
+        if (stdin_main) {
+            x->main = "-";
+        } else if (main_id) {
+            x->main = x->paths.entries[main_id].str;
+            x->unit[main_id] = p->config.dep_count;
+        } else {
+            fprintf(stderr, "Error: No main .nrs file found in %s\n", p->dir);
+            ok = 0;
+        }
+    }
+    free(sources);
+    return ok;
 }
 
-void codegen(int is_main) {
-    append_str("section .data\n");
-    append_str("msg db 'N0roshi running...', 10, 0\n");
-    append_str("input_buf db 0\n");
-    append_str("section .text\n");
-
-    if (target_platform == PLATFORM_MACOS || target_platform == PLATFORM_IOS) {
-        append_str("extern _getchar\n");
-        append_str("extern _printf\n");
-        if (is_main) append_str("global _main\n");
-    } else if (target_platform == PLATFORM_WINDOWS) {
-        append_str("extern getchar\n");
-        append_str("extern printf\n");
-        if (is_main) append_str("global main\n");
-    } else {
-        append_str("extern getchar\n");
-        append_str("extern printf\n");
-        if (is_main) append_str("global main\n");
-    }
-
-    append_str("kbhit:\n");
-    if (target_platform == PLATFORM_MACOS || target_platform == PLATFORM_IOS) {
-        append_str("  mov rax, 0x2000003\n");
-        append_str("  mov rdi, 0\n");
-        append_str("  syscall\n");
-        append_str("  cmp rax, -1\n");
-    } else if (target_platform == PLATFORM_FREEBSD) {
-        append_str("  mov rax, 3\n");
-        append_str("  mov rdi, 0\n");
-        append_str("  mov rsi, input_buf\n");
-        append_str("  mov rdx, 1\n");
-        append_str("  syscall\n");
-        append_str("  cmp rax, 0\n");
-    } else if (target_platform == PLATFORM_LINUX || target_platform == PLATFORM_ANDROID) {
-        append_str("  mov rax, 0\n");
-        append_str("  mov rdi, 0\n");
-        append_str("  mov rsi, input_buf\n");
-        append_str("  mov rdx, 1\n");
-        append_str("  syscall\n");
-        append_str("  cmp rax, 0\n");
+size_t scan_scalar(const char* s, size_t pos, size_t len, int cls) {
+    if (cls == CC_QUOTE) {
+        while (pos < len && char_class[(unsigned char)s[pos]] != CC_QUOTE) pos++;
     } else {
-        append_str("  call getchar\n");
-        append_str("  cmp rax, -1\n");
-        append_str("  je .no_key\n");
-        append_str("  mov byte [input_buf], al\n");
-        append_str("  mov rax, 1\n");
-        append_str("  ret\n");
-    }
-    if (target_platform != PLATFORM_WINDOWS) {
-        append_str("  je .no_key\n");
-        append_str("  mov byte [rel input_buf], al\n");
-        append_str("  mov rax, 1\n");
-        append_str("  ret\n");
-    }
-    append_str(".no_key:\n");
-    append_str("  xor rax, rax\n");
-    append_str("  ret\n");
-
-    if (is_main) {
-        if (target_platform == PLATFORM_MACOS || target_platform == PLATFORM_IOS) {
-            append_str("_main:\n");
+        while (pos < len && char_class[(unsigned char)s[pos]] == cls) pos++;
+    }
+    return pos;
+}
+
+#ifdef LEX_SIMD
+size_t scan_sse2(const char* s, size_t pos, size_t len, int cls) {
+    while (pos + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + pos));
+        __m128i t;
+        unsigned mask;
+        if (cls == CC_SPACE) {
+            t = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+            t = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t);
+            mask = ~_mm_movemask_epi8(_mm_or_si128(t, _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))));
+        } else if (cls == CC_DIGIT) {
+            t = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+            mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(9)), t));
+        } else if (cls == CC_ALPHA) {
+            t = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+            mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(25)), t));
         } else {
-            append_str("main:\n");
+            mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
         }
-    } else {
-        append_str("module_init:\n");
+        mask &= 0xFFFF;
+        if (mask) return pos + __builtin_ctz(mask);
+        pos += 16;
     }
-    append_str("  push rbp\n");
-    append_str("  mov rbp, rsp\n");
-    append_str("  sub rsp, 16\n");
+    return scan_scalar(s, pos, len, cls);
+}
 
-    for (int i = 0; i < ast_count; i++) {
-        if (ast[i].type == AST_BLOCK) {
-            continue;
-        } else if (ast[i].type == AST_VARDECL) {
-            append_str("  mov qword [rbp-8], 0\n");
-            if (ast[i].value2[0]) {
-                append_str("  mov rax, ");
-                append_str(ast[i].value2);
-                append_str("\n");
-                append_str("  mov [rbp-8], rax\n");
-            }
-        } else if (ast[i].type == AST_PRINT) {
-            if (target_platform == PLATFORM_MACOS || target_platform == PLATFORM_IOS) {
-                append_str("  lea rdi, [rel msg]\n");
-                append_str("  xor rax, rax\n");
-                append_str("  call _printf\n");
-            } else {
-                append_str("  lea rdi, [msg]\n");
-                append_str("  xor rax, rax\n");
-                append_str("  call printf\n");
-            }
-        } else if (ast[i].type == AST_KBCHK) {
-            append_str("  call kbhit\n");
-            append_str("  test rax, rax\n");
-            append_str("  jz .no_input\n");
-            append_str("  mov al, byte [rel input_buf]\n");
-            append_str("  cmp al, '");
-            append_str(config.exit_key);
-            append_str("'\n");
-            append_str("  je .exit\n");
-            append_str(".no_input:\n");
-        }
-    }
-
-    append_str(".exit:\n");
-    append_str("  mov rsp, rbp\n");
-    append_str("  pop rbp\n");
-    if (is_main) {
-        if (target_platform == PLATFORM_MACOS || target_platform == PLATFORM_IOS) {
-            append_str("  mov rax, 0x2000001\n");
-            append_str("  mov rdi, 0\n");
-            append_str("  syscall\n");
-        } else if (target_platform == PLATFORM_FREEBSD) {
-            append_str("  mov rax, 1\n");
-            append_str("  xor rdi, rdi\n");
-            append_str("  syscall\n");
-        } else if (target_platform == PLATFORM_LINUX || target_platform == PLATFORM_ANDROID) {
-            append_str("  mov rax, 60\n");
-            append_str("  xor rdi, rdi\n");
-            append_str("  syscall\n");
+__attribute__((target("avx2")))
+size_t scan_avx2(const char* s, size_t pos, size_t len, int cls) {
+    while (pos + 32 <= len) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + pos));
+        __m256i t;
+        uint32_t mask;
+        if (cls == CC_SPACE) {
+            t = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+            t = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(4)), t);
+            mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(t, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '))));
+        } else if (cls == CC_DIGIT) {
+            t = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+            mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(9)), t));
+        } else if (cls == CC_ALPHA) {
+            t = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+            mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(25)), t));
         } else {
-            append_str("  mov rcx, 0\n");
-            append_str("  call ExitProcess\n");
+            mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
         }
-    } else {
-        append_str("  ret\n");
+        if (mask) return pos + __builtin_ctz(mask);
+        pos += 32;
     }
+    return scan_sse2(s, pos, len, cls);
 }
+#endif
 
-void compile_file(const char* path, int is_main) {
-    token_count = 0;
-    ast_count = 0;
-    output_pos = 0;
-    char* input = read_file(path);
-    lexer(input);
-    n0ryst_log("[Parsing] 50%");
-    parser();
-    n0ryst_log("[Parsing] 100%");
-    n0ryst_log("[Type Checking] 0%");
-    n0ryst_log("[Type Checking] 100%");
-    n0ryst_log("[Codegen] 0%");
-    codegen(is_main);
-    n0ryst_log("[Codegen] 100%");
-    free(input);
+LexScanner lex_scanners[] = {
+    { "scalar", scan_scalar },
+#ifdef LEX_SIMD
+    { "sse2", scan_sse2 },
+    { "avx2", scan_avx2 },
+#endif
+};
+
+LexScanner* lex_scanner = &lex_scanners[0];
+
+int lex_scanner_supported(LexScanner* sc) {
+#ifdef LEX_SIMD
+    if (sc->scan == scan_avx2) return __builtin_cpu_supports("avx2");
+#endif
+    return 1;
 }
 
-void show_help() {
-    printf("n0ryst ver. 1.09, 2024-2025\n");
-    printf("Usage: n0ryst [options] [path]\n");
-    printf("Options:\n");
-    printf("  --help    Show this help message\n");
-    printf("  --version Show version\n");
-    printf("  --target <platform>  Target platform (macos, freebsd, linux, windows, ios, android)\n");
-    printf("  path      Directory with .nrs and .noi files\n");
-    exit(0);
+void lexer_select() {
+    int n = sizeof(lex_scanners) / sizeof(lex_scanners[0]);
+    for (int i = n - 1; i >= 0; i--) {
+        if (lex_scanner_supported(&lex_scanners[i])) {
+            lex_scanner = &lex_scanners[i];
+            return;
+        }
+    }
 }
 
-void show_version() {
-    printf("n0ryst ver. 1.09, 2024-2025\n");
-    exit(0);
+void lexer_init(Lexer* lx, const char* input, size_t len) {
+    lx->input = input;
+    lx->len = len;
+    lx->pos = 0;
+    lx->base = 0;
+    lx->scan = lex_scanner->scan;
 }
 
-int main(int argc, char* argv[]) {
-    char nrs_path[MAX_PATH] = "";
-    char dir[MAX_PATH] = ".";
+size_t lex_span(Lexer* lx, size_t pos, int cls) {
+    size_t end = lx->len - pos > LEX_SHORT_RUN ? pos + LEX_SHORT_RUN : lx->len;
+    int in_run = cls != CC_QUOTE;
+    while (pos < end && (char_class[(unsigned char)lx->input[pos]] == cls) == in_run) pos++;
+    if (pos < end || pos == lx->len) return pos;
+    return lx->scan(lx->input, pos, lx->len, cls);
+}
 
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "--help") == 0) {
-            show_help();
-        } else if (strcmp(argv[i], "--version") == 0) {
-            show_version();
-        } else if (strcmp(argv[i], "--target") == 0 && i + 1 < argc) {
-            i++;
-            if (strcmp(argv[i], "macos") == 0) {
-                target_platform = PLATFORM_MACOS;
-            } else if (strcmp(argv[i], "freebsd") == 0) {
-                target_platform = PLATFORM_FREEBSD;
-            } else if (strcmp(argv[i], "linux") == 0) {
-                target_platform = PLATFORM_LINUX;
-            } else if (strcmp(argv[i], "windows") == 0) {
-                target_platform = PLATFORM_WINDOWS;
-            } else if (strcmp(argv[i], "ios") == 0) {
-                target_platform = PLATFORM_IOS;
-            } else if (strcmp(argv[i], "android") == 0) {
-                target_platform = PLATFORM_ANDROID;
-            } else {
-                fprintf(stderr, "Error: Invalid target platform '%s'\n", argv[i]);
-                exit(1);
-            }
-        } else {
-            strncpy(dir, argv[i], MAX_PATH - 1);
+int lex_next(Lexer* lx, Token* tok) {
+    const char* input = lx->input;
+    size_t len = lx->len;
+    size_t pos = lx->pos;
+    if (pos < len && char_class[(unsigned char)input[pos]] == CC_SPACE) pos = lex_span(lx, pos + 1, CC_SPACE);
+    tok->start = pos;
+    tok->len = 0;
+    if (pos == len) {
+        lx->pos = pos;
+        tok->type = TOKEN_EOF;
+        return 0;
+    }
+    char c = input[pos];
+    int cls = char_class[(unsigned char)c];
+    if (cls == CC_SLASH && len - pos >= 3) {
+        if (memcmp(&input[pos], "/+[", 3) == 0) {
+            tok->type = TOKEN_OP_BLOCK_START;
+            tok->len = 3;
+            lx->pos = pos + 3;
+            return 1;
+        } else if (memcmp(&input[pos], "/=]", 3) == 0) {
+            tok->type = TOKEN_OP_BLOCK_END;
+            tok->len = 3;
+            lx->pos = pos + 3;
+            return 1;
         }
     }
+    switch (cls) {
+    case CC_QUOTE:
+        tok->start = ++pos;
+        pos = lex_span(lx, pos, CC_QUOTE);
+        tok->type = TOKEN_STRING;
+        tok->len = pos - tok->start;
+        if (pos < len) pos++;
+        break;
+    case CC_DIGIT:
+        pos = lex_span(lx, pos + 1, CC_DIGIT);
+        tok->type = TOKEN_NUMBER;
+        tok->len = pos - tok->start;
+        break;
+    case CC_ALPHA:
+        pos = lex_span(lx, pos + 1, CC_ALPHA);
+        tok->type = TOKEN_KEYWORD;
+        tok->len = pos - tok->start;
+        break;
+    case CC_EQUALS:
+        tok->type = TOKEN_SYMBOL;
+        tok->len = 1;
+        pos++;
+        break;
+    default:
+        fprintf(stderr, "Lexing error at position %zu, character '%c' (ASCII %d)\n", lx->base + pos, c, c);
+        fail();
+    }
+    lx->pos = pos;
+    return 1;
+}
 
-    read_noi(dir);
-    if (!find_nrs(dir, nrs_path)) {
-        exit(1);
+Token* push_token(CompileUnit* u) {
+    if (u->token_count == u->token_cap) {
+        u->token_cap = u->token_cap ? u->token_cap * 2 : 256;
+        u->tokens = xrealloc(u->tokens, u->token_cap * sizeof(Token));
+    }
+    return &u->tokens[u->token_count++];
+}
+
+ASTNode* push_node(CompileUnit* u, enum ASTType type) {
+    if (u->ast_count == u->ast_cap) {
+        u->ast_cap = u->ast_cap ? u->ast_cap * 2 : 256;
+        u->ast = xrealloc(u->ast, u->ast_cap * sizeof(ASTNode));
+    }
+    ASTNode* node = &u->ast[u->ast_count++];
+    *node = (ASTNode){ .type = type };
+    return node;
+}
+
+void lexer(CompileUnit* u, const char* input, size_t len) {
+    Lexer lx;
+    lexer_init(&lx, input, len);
+    u->src = input;
+    while (lex_next(&lx, push_token(u)));
+}
+
+enum Keyword keyword_lookup(const char* s, uint32_t len) {
+    const KeywordDef* k = &keywords[((unsigned char)s[0] ^ len) % 8];
+    return k->len == len && memcmp(s, k->text, len) == 0 ? k->keyword : KW_NONE;
+}
+
+uint32_t token_value(CompileUnit* u, int* token_pos) {
+    Token* t = &u->tokens[*token_pos];
+    if (t->type == TOKEN_EOF) {
+        fprintf(stderr, "Parsing error at token %d\n", *token_pos);
+        fail();
+    }
+    (*token_pos)++;
+    return intern(&u->arena, &u->strs, u->src + t->start, t->len);
+}
+
+const char* ast_str(CompileUnit* u, uint32_t id) {
+    return u->strs.entries[id].str;
+}
+
+void parser(CompileUnit* u) {
+    int token_pos = 0;
+    for (;;) {
+        if (u->tokens[token_pos].type == TOKEN_EOF) {
+            push_node(u, AST_END);
+            break;
+        }
+        int loop = 0;
+        Token* t = &u->tokens[token_pos];
+        if (t->type == TOKEN_KEYWORD && keyword_lookup(u->src + t->start, t->len) == KW_LOOP) {
+            ASTNode* node = push_node(u, AST_LOOP);
+            loop = 1;
+            token_pos++;
+            if (u->tokens[token_pos].type == TOKEN_NUMBER) {
+                node->value = token_value(u, &token_pos);
+                long long rate = strtoll(ast_str(u, node->value), NULL, 10);
+                if (rate < 1 || rate > 1000000000) {
+                    fprintf(stderr, "Parsing error: loop rate %s out of range\n", ast_str(u, node->value));
+                    fail();
+                }
+            }
+        }
+        if (u->tokens[token_pos].type == TOKEN_OP_BLOCK_START) {
+            token_pos++;
+            push_node(u, AST_BLOCK);
+            while (u->tokens[token_pos].type != TOKEN_OP_BLOCK_END) {
+                Token* t = &u->tokens[token_pos];
+                if (t->type == TOKEN_KEYWORD) {
+                    ASTNode* node;
+                    token_pos++;
+                    switch (keyword_lookup(u->src + t->start, t->len)) {
+                    case KW_LET:
+                        node = push_node(u, AST_VARDECL);
+                        node->value = token_value(u, &token_pos);
+                        if (u->tokens[token_pos].type == TOKEN_SYMBOL) {
+                            token_pos++;
+                            if (u->tokens[token_pos].type == TOKEN_KEYWORD) node->type = AST_VARCOPY;
+                            if (u->tokens[token_pos].type == TOKEN_STRING) node->type = AST_VARSTR;
+                            node->value2 = token_value(u, &token_pos);
+                        }
+                        break;
+                    case KW_PNT:
+                        node = push_node(u, AST_PRINT);
+                        node->value = token_value(u, &token_pos);
+                        break;
+                    case KW_KBCHK:
+                        node = push_node(u, AST_KBCHK);
+                        break;
+                    default:
+                        fprintf(stderr, "Parsing error: unknown keyword %.*s\n", (int)t->len, u->src + t->start);
+                        fail();
+                    }
+                    node->pos = t->start;
+                } else {
+                    fprintf(stderr, "Parsing error at token %d\n", token_pos);
+                    fail();
+                }
+            }
+            token_pos++;
+            if (loop) push_node(u, AST_LOOP_END);
+        } else {
+            fprintf(stderr, "Parsing error: expected block start\n");
+            fail();
+        }
+    }
+}
+
+const char* reg_names[] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+
+const char* reg8_names[] = {
+    "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"
+};
+
+const unsigned char reg_name_lens[] = { 3, 3, 3, 3, 3, 3, 3, 3, 2, 2, 3, 3, 3, 3, 3, 3 };
+const unsigned char reg8_name_lens[] = { 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4 };
+
+void out_bytes(OutBuf* o, const char* data, size_t len) {
+    while (len) {
+        if (!o->tail || o->tail->len == OUT_CHUNK_SIZE) {
+            OutChunk* c = xrealloc(NULL, sizeof(OutChunk));
+            c->next = NULL;
+            c->len = 0;
+            if (o->tail) o->tail->next = c;
+            else o->head = c;
+            o->tail = c;
+        }
+        size_t n = OUT_CHUNK_SIZE - o->tail->len;
+        if (n > len) n = len;
+        memcpy(o->tail->data + o->tail->len, data, n);
+        o->tail->len += n;
+        o->total += n;
+        data += n;
+        len -= n;
+    }
+}
+
+#define out_lit(o, lit) out_bytes(o, lit, sizeof(lit) - 1)
+
+void out_str(OutBuf* o, const char* str) {
+    out_bytes(o, str, strlen(str));
+}
+
+void out_char(OutBuf* o, char c) {
+    if (o->tail && o->tail->len < OUT_CHUNK_SIZE) {
+        o->tail->data[o->tail->len++] = c;
+        o->total++;
+    } else {
+        out_bytes(o, &c, 1);
+    }
+}
+
+void out_uint(OutBuf* o, unsigned long long v, int base) {
+    char digits[24];
+    int n = sizeof(digits);
+    do {
+        digits[--n] = "0123456789abcdef"[v % base];
+        v /= base;
+    } while (v);
+    out_bytes(o, digits + n, sizeof(digits) - n);
+}
+
+void out_int(OutBuf* o, long long v) {
+    if (v < 0) {
+        out_char(o, '-');
+        out_uint(o, -(unsigned long long)v, 10);
+    } else {
+        out_uint(o, v, 10);
+    }
+}
+
+void out_imm(OutBuf* o, long long imm) {
+    if (imm > 0xFFFF) {
+        out_lit(o, "0x");
+        out_uint(o, imm, 16);
+    } else {
+        out_int(o, imm);
+    }
+}
+
+void out_reg(OutBuf* o, int reg) {
+    out_bytes(o, reg_names[reg], reg_name_lens[reg]);
+}
+
+void out_reg8(OutBuf* o, int reg) {
+    out_bytes(o, reg8_names[reg], reg8_name_lens[reg]);
+}
+
+void out_label(OutBuf* o, const char* name) {
+    out_str(o, name);
+    out_lit(o, ":\n");
+}
+
+void out_mem(OutBuf* o, int base, int disp) {
+    out_char(o, '[');
+    out_reg(o, base);
+    if (disp >= 0) out_char(o, '+');
+    out_int(o, disp);
+    out_char(o, ']');
+}
+
+int out_write(OutBuf* o, int fd) {
+    OutChunk* c = o->head;
+    size_t skip = 0;
+    while (c) {
+#ifdef _WIN32
+        int w = write(fd, c->data + skip, c->len - skip);
+#else
+        struct iovec iov[OUT_IOV_MAX];
+        int n = 0;
+        for (OutChunk* it = c; it && n < OUT_IOV_MAX; it = it->next, n++) {
+            iov[n].iov_base = it->data + (n ? 0 : skip);
+            iov[n].iov_len = it->len - (n ? 0 : skip);
+        }
+        ssize_t w = writev(fd, iov, n);
+#endif
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        while (c && (size_t)w >= c->len - skip) {
+            w -= c->len - skip;
+            skip = 0;
+            c = c->next;
+        }
+        if (c) skip += w;
+    }
+    return 1;
+}
+
+void out_free(OutBuf* o) {
+    while (o->head) {
+        OutChunk* next = o->head->next;
+        free(o->head);
+        o->head = next;
+    }
+    o->tail = NULL;
+    o->total = 0;
+}
+
+const char* unit_name(CompileUnit* u, const char* prefix, int n) {
+    char name[64];
+    int len = snprintf(name, sizeof(name), "%s%d", prefix, n);
+    return memcpy(arena_alloc(&u->arena, len + 1), name, len + 1);
+}
+
+void emit_insn(CompileUnit* u, Insn insn) {
+    if (u->insn_count == u->insn_cap) {
+        u->insn_cap = u->insn_cap ? u->insn_cap * 2 : 64;
+        u->insns = xrealloc(u->insns, u->insn_cap * sizeof(Insn));
+    }
+    u->insns[u->insn_count++] = insn;
+}
+
+void asm_data(CompileUnit* u, const char* section, const char* name, const char* bytes, int len) {
+    if (u->data_count == u->data_cap) {
+        u->data_cap = u->data_cap ? u->data_cap * 2 : 16;
+        u->data = xrealloc(u->data, u->data_cap * sizeof(DataDef));
+    }
+    u->data[u->data_count++] = (DataDef){ section, name, bytes, len };
+}
+
+void asm_extern(CompileUnit* u, const char* name) {
+    if (u->extern_count == u->extern_cap) {
+        u->extern_cap = u->extern_cap ? u->extern_cap * 2 : 16;
+        u->externs = xrealloc(u->externs, u->extern_cap * sizeof(char*));
+    }
+    u->externs[u->extern_count++] = name;
+}
+
+void asm_global(CompileUnit* u, const char* name) {
+    if (u->global_count == u->global_cap) {
+        u->global_cap = u->global_cap ? u->global_cap * 2 : 16;
+        u->globals = xrealloc(u->globals, u->global_cap * sizeof(char*));
+    }
+    u->globals[u->global_count++] = name;
+}
+
+void asm_label(CompileUnit* u, const char* name) {
+    emit_insn(u, (Insn){ .op = INSN_LABEL, .sym = name });
+}
+
+void asm_section(CompileUnit* u, const char* name) {
+    emit_insn(u, (Insn){ .op = INSN_SECTION, .sym = name });
+}
+
+void asm_op(CompileUnit* u, enum InsnOp op) {
+    emit_insn(u, (Insn){ .op = op });
+}
+
+void asm_reg(CompileUnit* u, enum InsnOp op, int reg) {
+    emit_insn(u, (Insn){ .op = op, .reg = reg });
+}
+
+void asm_reg_reg(CompileUnit* u, enum InsnOp op, int reg, int reg2) {
+    emit_insn(u, (Insn){ .op = op, .reg = reg, .reg2 = reg2 });
+}
+
+void asm_reg_imm(CompileUnit* u, enum InsnOp op, int reg, long long imm) {
+    emit_insn(u, (Insn){ .op = op, .reg = reg, .imm = imm });
+}
+
+void asm_reg_sym(CompileUnit* u, enum InsnOp op, int reg, const char* sym) {
+    emit_insn(u, (Insn){ .op = op, .reg = reg, .sym = sym });
+}
+
+void asm_sym(CompileUnit* u, enum InsnOp op, const char* sym) {
+    emit_insn(u, (Insn){ .op = op, .sym = sym });
+}
+
+void asm_store_imm(CompileUnit* u, int disp, long long imm) {
+    emit_insn(u, (Insn){ .op = INSN_STORE_MI, .reg = REG_RBP, .disp = disp, .imm = imm });
+}
+
+void asm_store_reg(CompileUnit* u, int disp, int reg) {
+    emit_insn(u, (Insn){ .op = INSN_STORE_MR, .reg = reg, .reg2 = REG_RBP, .disp = disp });
+}
+
+void asm_load_reg(CompileUnit* u, int reg, int disp) {
+    emit_insn(u, (Insn){ .op = INSN_LOAD_RM, .reg = reg, .reg2 = REG_RBP, .disp = disp });
+}
+
+void asm_load_mem(CompileUnit* u, int reg, int base, int disp) {
+    emit_insn(u, (Insn){ .op = INSN_LOAD_RM, .reg = reg, .reg2 = base, .disp = disp });
+}
+
+void asm_store_mem(CompileUnit* u, int base, int disp, int reg) {
+    emit_insn(u, (Insn){ .op = INSN_STORE_MR, .reg = reg, .reg2 = base, .disp = disp });
+}
+
+void out_data(OutBuf* o, DataDef* d) {
+    int in_str = 0;
+    out_str(o, d->name);
+    if (!d->bytes) {
+        out_lit(o, " resb ");
+        out_uint(o, d->len, 10);
+        out_char(o, '\n');
+        return;
+    }
+    out_lit(o, " db ");
+    for (int i = 0; i < d->len; i++) {
+        unsigned char c = d->bytes[i];
+        if (isprint(c) && c != '\'') {
+            if (!in_str) {
+                if (i) out_lit(o, ", ");
+                out_char(o, '\'');
+            }
+            out_char(o, c);
+            in_str = 1;
+        } else {
+            if (in_str) out_char(o, '\'');
+            if (i) out_lit(o, ", ");
+            out_uint(o, c, 10);
+            in_str = 0;
+        }
+    }
+    if (in_str) out_char(o, '\'');
+    out_char(o, '\n');
+}
+
+void out_section(OutBuf* o, const char* name, int elf) {
+    int exec = strncmp(name, ".text", 5) == 0;
+    int bss = strncmp(name, ".bss", 4) == 0;
+    const char* base = exec ? ".text" : bss ? ".bss" : ".data";
+    out_lit(o, "section ");
+    if (!elf || strcmp(name, base) == 0 || strcmp(name, ".rodata") == 0) {
+        out_str(o, elf ? name : base);
+        out_char(o, '\n');
+        return;
+    }
+    out_str(o, name);
+    if (exec) out_lit(o, " progbits alloc exec nowrite align=16\n");
+    else if (bss) out_lit(o, " nobits alloc noexec write align=8\n");
+    else out_lit(o, " progbits alloc noexec write align=4\n");
+}
+
+void emit_text(CompileUnit* u) {
+    OutBuf* o = &u->out;
+    const char* section = NULL;
+    for (int i = 0; i < u->data_count; i++) {
+        if (!section || strcmp(section, u->data[i].section) != 0) {
+            section = u->data[i].section;
+            out_section(o, section, u->backend->elf);
+        }
+        out_data(o, &u->data[i]);
+    }
+    out_lit(o, "section .text\n");
+    for (int i = 0; i < u->extern_count; i++) {
+        out_lit(o, "extern ");
+        out_str(o, u->externs[i]);
+        out_char(o, '\n');
+    }
+    for (int i = 0; i < u->global_count; i++) {
+        out_lit(o, "global ");
+        out_str(o, u->globals[i]);
+        out_char(o, '\n');
+    }
+    for (int i = 0; i < u->insn_count; i++) {
+        Insn* in = &u->insns[i];
+        switch (in->op) {
+        case INSN_LABEL:
+            out_label(o, in->sym);
+            continue;
+        case INSN_SECTION:
+            out_section(o, in->sym, u->backend->elf);
+            continue;
+        case INSN_MOV_RI:
+        case INSN_CMP_RI:
+        case INSN_ADD_RI:
+        case INSN_SUB_RI:
+        case INSN_AND_RI:
+        case INSN_SHL_RI:
+            if (in->op == INSN_MOV_RI) out_lit(o, "  mov ");
+            else if (in->op == INSN_CMP_RI) out_lit(o, "  cmp ");
+            else if (in->op == INSN_ADD_RI) out_lit(o, "  add ");
+            else if (in->op == INSN_SUB_RI) out_lit(o, "  sub ");
+            else if (in->op == INSN_SHL_RI) out_lit(o, "  shl ");
+            else out_lit(o, "  and ");
+            out_reg(o, in->reg);
+            out_lit(o, ", ");
+            out_imm(o, in->imm);
+            break;
+        case INSN_MOV_RR:
+        case INSN_TEST_RR:
+        case INSN_XOR_RR:
+        case INSN_ADD_RR:
+        case INSN_SUB_RR:
+        case INSN_CMP_RR:
+        case INSN_OR_RR:
+            if (in->op == INSN_MOV_RR) out_lit(o, "  mov ");
+            else if (in->op == INSN_TEST_RR) out_lit(o, "  test ");
+            else if (in->op == INSN_XOR_RR) out_lit(o, "  xor ");
+            else if (in->op == INSN_ADD_RR) out_lit(o, "  add ");
+            else if (in->op == INSN_SUB_RR) out_lit(o, "  sub ");
+            else if (in->op == INSN_OR_RR) out_lit(o, "  or ");
+            else out_lit(o, "  cmp ");
+            out_reg(o, in->reg);
+            out_lit(o, ", ");
+            out_reg(o, in->reg2);
+            break;
+        case INSN_MOV_RSYM:
+            out_lit(o, "  mov ");
+            out_reg(o, in->reg);
+            out_lit(o, ", ");
+            out_str(o, in->sym);
+            break;
+        case INSN_LEA_RSYM:
+            out_lit(o, "  lea ");
+            out_reg(o, in->reg);
+            out_lit(o, ", [rel ");
+            out_str(o, in->sym);
+            out_char(o, ']');
+            break;
+        case INSN_STORE_MI:
+            out_lit(o, "  mov qword ");
+            out_mem(o, in->reg, in->disp);
+            out_lit(o, ", ");
+            out_imm(o, in->imm);
+            break;
+        case INSN_STORE_MR:
+            out_lit(o, "  mov ");
+            out_mem(o, in->reg2, in->disp);
+            out_lit(o, ", ");
+            out_reg(o, in->reg);
+            break;
+        case INSN_LOAD_RM:
+            out_lit(o, "  mov ");
+            out_reg(o, in->reg);
+            out_lit(o, ", ");
+            out_mem(o, in->reg2, in->disp);
+            break;
+        case INSN_STORE8_SYM:
+            out_lit(o, "  mov byte [rel ");
+            out_str(o, in->sym);
+            out_lit(o, "], ");
+            out_reg8(o, in->reg);
+            break;
+        case INSN_STORE8_MR:
+            out_lit(o, "  mov byte ");
+            out_mem(o, in->reg2, in->disp);
+            out_lit(o, ", ");
+            out_reg8(o, in->reg);
+            break;
+        case INSN_LOAD8_SYM:
+            out_lit(o, "  mov ");
+            out_reg8(o, in->reg);
+            out_lit(o, ", byte [rel ");
+            out_str(o, in->sym);
+            out_char(o, ']');
+            break;
+        case INSN_LOAD8_RM:
+            out_lit(o, "  mov ");
+            out_reg8(o, in->reg);
+            out_lit(o, ", byte ");
+            out_mem(o, in->reg2, in->disp);
+            break;
+        case INSN_CMP8_RI:
+            out_lit(o, "  cmp ");
+            out_reg8(o, in->reg);
+            out_lit(o, ", ");
+            if (isprint((int)in->imm) && in->imm != '\'') {
+                out_char(o, '\'');
+                out_char(o, (char)in->imm);
+                out_char(o, '\'');
+            } else {
+                out_imm(o, in->imm);
+            }
+            break;
+        case INSN_JMP:
+            out_lit(o, "  jmp ");
+            out_str(o, in->sym);
+            break;
+        case INSN_JE:
+            out_lit(o, "  je ");
+            out_str(o, in->sym);
+            break;
+        case INSN_JZ:
+            out_lit(o, "  jz ");
+            out_str(o, in->sym);
+            break;
+        case INSN_JNZ:
+            out_lit(o, "  jnz ");
+            out_str(o, in->sym);
+            break;
+        case INSN_JB:
+            out_lit(o, "  jb ");
+            out_str(o, in->sym);
+            break;
+        case INSN_JBE:
+            out_lit(o, "  jbe ");
+            out_str(o, in->sym);
+            break;
+        case INSN_JLE:
+            out_lit(o, "  jle ");
+            out_str(o, in->sym);
+            break;
+        case INSN_REP_MOVSB:
+            out_lit(o, "  rep movsb");
+            break;
+        case INSN_DIV_R:
+            out_lit(o, "  div ");
+            out_reg(o, in->reg);
+            break;
+        case INSN_RDTSC:
+            out_lit(o, "  rdtsc");
+            break;
+        case INSN_CALL:
+            out_lit(o, "  call ");
+            out_str(o, in->sym);
+            break;
+        case INSN_PUSH:
+            out_lit(o, "  push ");
+            out_reg(o, in->reg);
+            break;
+        case INSN_POP:
+            out_lit(o, "  pop ");
+            out_reg(o, in->reg);
+            break;
+        case INSN_RET:
+            out_lit(o, "  ret");
+            break;
+        case INSN_SYSCALL:
+            out_lit(o, "  syscall");
+            break;
+        }
+        out_char(o, '\n');
+    }
+}
+
+void buf_put(ByteBuf* b, const void* data, size_t len) {
+    if (b->len + len > b->cap) {
+        while (b->len + len > b->cap) b->cap = b->cap ? b->cap * 2 : 256;
+        b->data = xrealloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+void buf_byte(ByteBuf* b, int v) {
+    unsigned char c = v;
+    buf_put(b, &c, 1);
+}
+
+void buf_u16(ByteBuf* b, uint16_t v) {
+    buf_put(b, &v, 2);
+}
+
+void buf_u32(ByteBuf* b, uint32_t v) {
+    buf_put(b, &v, 4);
+}
+
+void buf_u64(ByteBuf* b, uint64_t v) {
+    buf_put(b, &v, 8);
+}
+
+void buf_align(ByteBuf* b, size_t align) {
+    while (b->len % align) buf_byte(b, 0);
+}
+
+enum { FIX_PC32, FIX_CALL, FIX_ABS64 };
+
+typedef struct {
+    char* name;
+    int section;
+    long long value;
+    int is_global;
+    int index;
+} ObjSym;
+
+typedef struct {
+    int section;
+    size_t offset;
+    size_t insn_end;
+    int kind;
+    char* name;
+} ObjFixup;
+
+typedef struct {
+    const char* name;
+    ByteBuf buf;
+    ByteBuf rela;
+    int exec;
+    int rela_index;
+} ObjSection;
+
+typedef struct {
+    ObjSection secs[MAX_SECTIONS];
+    int sec_count;
+    int cur;
+    ObjSym* syms;
+    int sym_count;
+    int sym_cap;
+    int* sym_slots;
+    size_t slot_cap;
+    ObjFixup* fixups;
+    int fixup_count;
+    int fixup_cap;
+    const char* scope;
+} ObjWriter;
+
+int obj_section(CompileUnit* u, ObjWriter* w, const char* name) {
+    for (int i = 1; i < w->sec_count; i++) {
+        if (strcmp(w->secs[i].name, name) == 0) return i;
+    }
+    if (w->sec_count == MAX_SECTIONS) {
+        fprintf(stderr, "Error: Too many sections in %s\n", u->path);
+        fail();
+    }
+    w->secs[w->sec_count] = (ObjSection){ .name = name, .exec = strncmp(name, ".text", 5) == 0 };
+    return w->sec_count++;
+}
+
+char* scoped_name(ObjWriter* w, const char* name) {
+    char* full;
+    if (name[0] == '.' && w->scope) {
+        full = malloc(strlen(w->scope) + strlen(name) + 1);
+        if (full) sprintf(full, "%s%s", w->scope, name);
+    } else {
+        full = strdup(name);
+    }
+    if (!full) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    return full;
+}
+
+size_t sym_slot(ObjWriter* w, const char* name) {
+    size_t mask = w->slot_cap - 1;
+    size_t i = hash_bytes(0xcbf29ce484222325ULL, name, strlen(name)) & mask;
+    while (w->sym_slots[i] && strcmp(w->syms[w->sym_slots[i] - 1].name, name) != 0) i = (i + 1) & mask;
+    return i;
+}
+
+ObjSym* find_sym(ObjWriter* w, const char* name) {
+    if (!w->slot_cap) return NULL;
+    int index = w->sym_slots[sym_slot(w, name)];
+    return index ? &w->syms[index - 1] : NULL;
+}
+
+void define_sym(CompileUnit* u, ObjWriter* w, const char* name, int section, long long value) {
+    char* full = scoped_name(w, name);
+    if (find_sym(w, full)) {
+        fprintf(stderr, "Error: Symbol '%s' redefined in %s\n", full, u->path);
+        fail();
+    }
+    if (w->sym_count == w->sym_cap) {
+        w->sym_cap = w->sym_cap ? w->sym_cap * 2 : 64;
+        w->syms = xrealloc(w->syms, w->sym_cap * sizeof(ObjSym));
+    }
+    if ((size_t)(w->sym_count + 1) * 2 > w->slot_cap) {
+        free(w->sym_slots);
+        w->slot_cap = w->slot_cap ? w->slot_cap * 2 : 256;
+        w->sym_slots = calloc(w->slot_cap, sizeof(int));
+        if (!w->sym_slots) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
+        }
+        for (int i = 0; i < w->sym_count; i++) w->sym_slots[sym_slot(w, w->syms[i].name)] = i + 1;
+    }
+    w->syms[w->sym_count] = (ObjSym){ .name = full, .section = section, .value = value };
+    w->sym_slots[sym_slot(w, full)] = ++w->sym_count;
+}
+
+void add_fixup(ObjWriter* w, const char* name, int kind, size_t width) {
+    ByteBuf* b = &w->secs[w->cur].buf;
+    if (w->fixup_count == w->fixup_cap) {
+        w->fixup_cap = w->fixup_cap ? w->fixup_cap * 2 : 64;
+        w->fixups = xrealloc(w->fixups, w->fixup_cap * sizeof(ObjFixup));
+    }
+    w->fixups[w->fixup_count++] = (ObjFixup){
+        .section = w->cur, .offset = b->len, .insn_end = b->len + width, .kind = kind, .name = scoped_name(w, name)
+    };
+    if (kind == FIX_ABS64) buf_u64(b, 0);
+    else buf_u32(b, 0);
+}
+
+void enc_rex(ByteBuf* b, int w, int reg, int rm) {
+    int rex = 0x40 | (w ? 8 : 0) | (reg & 8 ? 4 : 0) | (rm & 8 ? 1 : 0);
+    if (rex != 0x40) buf_byte(b, rex);
+}
+
+void enc_modrm_mem(ByteBuf* b, int reg, int base, int disp) {
+    int mod = disp >= -128 && disp <= 127 ? 1 : 2;
+    buf_byte(b, (mod << 6) | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == REG_RSP) buf_byte(b, 0x24);
+    if (mod == 1) buf_byte(b, disp & 0xFF);
+    else buf_u32(b, (uint32_t)disp);
+}
+
+void enc_rip(ObjWriter* w, int opcode, int reg, const char* sym) {
+    ByteBuf* b = &w->secs[w->cur].buf;
+    buf_byte(b, opcode);
+    buf_byte(b, ((reg & 7) << 3) | 5);
+    add_fixup(w, sym, FIX_PC32, 4);
+}
+
+void enc_alu_imm(ByteBuf* b, int ext, int reg, long long imm) {
+    enc_rex(b, 1, 0, reg);
+    if (imm >= -128 && imm <= 127) {
+        buf_byte(b, 0x83);
+        buf_byte(b, 0xC0 | (ext << 3) | (reg & 7));
+        buf_byte(b, imm & 0xFF);
+    } else {
+        buf_byte(b, 0x81);
+        buf_byte(b, 0xC0 | (ext << 3) | (reg & 7));
+        buf_u32(b, (uint32_t)imm);
+    }
+}
+
+void encode_insn(CompileUnit* u, ObjWriter* w, Insn* in) {
+    ByteBuf* b = &w->secs[w->cur].buf;
+    switch (in->op) {
+    case INSN_LABEL:
+        if (in->sym[0] != '.') w->scope = in->sym;
+        define_sym(u, w, in->sym, w->cur, b->len);
+        break;
+    case INSN_SECTION:
+        w->cur = obj_section(u, w, in->sym);
+        break;
+    case INSN_MOV_RI:
+        if (in->imm >= 0 && in->imm <= 0xFFFFFFFFLL) {
+            enc_rex(b, 0, 0, in->reg);
+            buf_byte(b, 0xB8 + (in->reg & 7));
+            buf_u32(b, (uint32_t)in->imm);
+        } else if (in->imm >= INT32_MIN && in->imm <= INT32_MAX) {
+            enc_rex(b, 1, 0, in->reg);
+            buf_byte(b, 0xC7);
+            buf_byte(b, 0xC0 | (in->reg & 7));
+            buf_u32(b, (uint32_t)in->imm);
+        } else {
+            enc_rex(b, 1, 0, in->reg);
+            buf_byte(b, 0xB8 + (in->reg & 7));
+            buf_u64(b, (uint64_t)in->imm);
+        }
+        break;
+    case INSN_MOV_RR:
+    case INSN_TEST_RR:
+    case INSN_XOR_RR:
+    case INSN_ADD_RR:
+    case INSN_SUB_RR:
+    case INSN_CMP_RR:
+    case INSN_OR_RR:
+        enc_rex(b, 1, in->reg2, in->reg);
+        buf_byte(b, in->op == INSN_MOV_RR ? 0x89 : in->op == INSN_TEST_RR ? 0x85 : in->op == INSN_XOR_RR ? 0x31
+            : in->op == INSN_ADD_RR ? 0x01 : in->op == INSN_SUB_RR ? 0x29 : in->op == INSN_OR_RR ? 0x09 : 0x39);
+        buf_byte(b, 0xC0 | ((in->reg2 & 7) << 3) | (in->reg & 7));
+        break;
+    case INSN_MOV_RSYM:
+        enc_rex(b, 1, 0, in->reg);
+        buf_byte(b, 0xB8 + (in->reg & 7));
+        add_fixup(w, in->sym, FIX_ABS64, 8);
+        break;
+    case INSN_LEA_RSYM:
+        enc_rex(b, 1, in->reg, 0);
+        enc_rip(w, 0x8D, in->reg, in->sym);
+        break;
+    case INSN_STORE_MI:
+        enc_rex(b, 1, 0, in->reg);
+        buf_byte(b, 0xC7);
+        enc_modrm_mem(b, 0, in->reg, in->disp);
+        buf_u32(b, (uint32_t)in->imm);
+        break;
+    case INSN_STORE_MR:
+    case INSN_LOAD_RM:
+        enc_rex(b, 1, in->reg, in->reg2);
+        buf_byte(b, in->op == INSN_STORE_MR ? 0x89 : 0x8B);
+        enc_modrm_mem(b, in->reg, in->reg2, in->disp);
+        break;
+    case INSN_STORE8_SYM:
+    case INSN_LOAD8_SYM:
+        if (in->reg >= 4) buf_byte(b, 0x40 | (in->reg & 8 ? 4 : 0));
+        enc_rip(w, in->op == INSN_STORE8_SYM ? 0x88 : 0x8A, in->reg, in->sym);
+        break;
+    case INSN_CMP_RI:
+        enc_alu_imm(b, 7, in->reg, in->imm);
+        break;
+    case INSN_SUB_RI:
+        enc_alu_imm(b, 5, in->reg, in->imm);
+        break;
+    case INSN_ADD_RI:
+        enc_alu_imm(b, 0, in->reg, in->imm);
+        break;
+    case INSN_AND_RI:
+        enc_alu_imm(b, 4, in->reg, in->imm);
+        break;
+    case INSN_LOAD8_RM:
+    case INSN_STORE8_MR:
+        if (in->reg >= 4 || in->reg2 >= 8) buf_byte(b, 0x40 | (in->reg & 8 ? 4 : 0) | (in->reg2 & 8 ? 1 : 0));
+        buf_byte(b, in->op == INSN_STORE8_MR ? 0x88 : 0x8A);
+        enc_modrm_mem(b, in->reg, in->reg2, in->disp);
+        break;
+    case INSN_SHL_RI:
+        enc_rex(b, 1, 0, in->reg);
+        buf_byte(b, 0xC1);
+        buf_byte(b, 0xE0 | (in->reg & 7));
+        buf_byte(b, in->imm & 0x3F);
+        break;
+    case INSN_DIV_R:
+        enc_rex(b, 1, 0, in->reg);
+        buf_byte(b, 0xF7);
+        buf_byte(b, 0xF0 | (in->reg & 7));
+        break;
+    case INSN_RDTSC:
+        buf_byte(b, 0x0F);
+        buf_byte(b, 0x31);
+        break;
+    case INSN_REP_MOVSB:
+        buf_byte(b, 0xF3);
+        buf_byte(b, 0xA4);
+        break;
+    case INSN_CMP8_RI:
+        if (in->reg == REG_RAX) {
+            buf_byte(b, 0x3C);
+        } else {
+            if (in->reg >= 4) buf_byte(b, 0x40 | (in->reg & 8 ? 1 : 0));
+            buf_byte(b, 0x80);
+            buf_byte(b, 0xF8 | (in->reg & 7));
+        }
+        buf_byte(b, in->imm & 0xFF);
+        break;
+    case INSN_JMP:
+        buf_byte(b, 0xE9);
+        add_fixup(w, in->sym, FIX_PC32, 4);
+        break;
+    case INSN_JE:
+    case INSN_JZ:
+    case INSN_JNZ:
+    case INSN_JB:
+    case INSN_JBE:
+    case INSN_JLE:
+        buf_byte(b, 0x0F);
+        buf_byte(b, in->op == INSN_JNZ ? 0x85 : in->op == INSN_JB ? 0x82 : in->op == INSN_JBE ? 0x86 : in->op == INSN_JLE ? 0x8E : 0x84);
+        add_fixup(w, in->sym, FIX_PC32, 4);
+        break;
+    case INSN_CALL:
+        buf_byte(b, 0xE8);
+        add_fixup(w, in->sym, FIX_CALL, 4);
+        break;
+    case INSN_PUSH:
+    case INSN_POP:
+        enc_rex(b, 0, 0, in->reg);
+        buf_byte(b, (in->op == INSN_PUSH ? 0x50 : 0x58) + (in->reg & 7));
+        break;
+    case INSN_RET:
+        buf_byte(b, 0xC3);
+        break;
+    case INSN_SYSCALL:
+        buf_byte(b, 0x0F);
+        buf_byte(b, 0x05);
+        break;
+    }
+}
+
+#define R_X86_64_64 1
+#define R_X86_64_PC32 2
+#define R_X86_64_PLT32 4
+
+typedef struct {
+    uint64_t offset;
+    uint64_t info;
+    int64_t addend;
+} ElfRela;
+
+void elf_shdr(ByteBuf* b, uint32_t name, uint32_t type, uint64_t flags, uint64_t offset, uint64_t size,
+              uint32_t link, uint32_t info, uint64_t align, uint64_t entsize) {
+    buf_u32(b, name);
+    buf_u32(b, type);
+    buf_u64(b, flags);
+    buf_u64(b, 0);
+    buf_u64(b, offset);
+    buf_u64(b, size);
+    buf_u32(b, link);
+    buf_u32(b, info);
+    buf_u64(b, align);
+    buf_u64(b, entsize);
+}
+
+void elf_sym(ByteBuf* b, uint32_t name, int info, int shndx, uint64_t value) {
+    buf_u32(b, name);
+    buf_byte(b, info);
+    buf_byte(b, 0);
+    buf_u16(b, shndx);
+    buf_u64(b, value);
+    buf_u64(b, 0);
+}
+
+int extern_declared(CompileUnit* u, const char* name) {
+    for (int i = 0; i < u->extern_count; i++) {
+        if (strcmp(u->externs[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+int global_declared(CompileUnit* u, const char* name) {
+    for (int i = 0; i < u->global_count; i++) {
+        if (strcmp(u->globals[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+void obj_encode(CompileUnit* u, ObjWriter* w) {
+    for (int i = 0; i < u->data_count; i++) {
+        w->cur = obj_section(u, w, u->data[i].section);
+        define_sym(u, w, u->data[i].name, w->cur, w->secs[w->cur].buf.len);
+        if (u->data[i].bytes) buf_put(&w->secs[w->cur].buf, u->data[i].bytes, u->data[i].len);
+        else for (int k = 0; k < u->data[i].len; k++) buf_byte(&w->secs[w->cur].buf, 0);
+    }
+    w->cur = obj_section(u, w, ".text");
+    for (int i = 0; i < u->insn_count; i++) {
+        encode_insn(u, w, &u->insns[i]);
+    }
+}
+
+void obj_free(ObjWriter* w) {
+    for (int i = 0; i < w->sym_count; i++) free(w->syms[i].name);
+    for (int i = 0; i < w->fixup_count; i++) free(w->fixups[i].name);
+    for (int i = 1; i < w->sec_count; i++) {
+        free(w->secs[i].buf.data);
+        free(w->secs[i].rela.data);
+    }
+    free(w->syms);
+    free(w->sym_slots);
+    free(w->fixups);
+    *w = (ObjWriter){ .sec_count = 1 };
+}
+
+void obj_finish(CompileUnit* u, ObjWriter* w) {
+    for (int i = 0; i < w->fixup_count; i++) {
+        ObjFixup* f = &w->fixups[i];
+        ObjSection* sec = &w->secs[f->section];
+        ObjSym* sym = find_sym(w, f->name);
+        if (!sym) {
+            if (!extern_declared(u, f->name)) {
+                fprintf(stderr, "Error: Undefined symbol '%s' in %s\n", f->name, u->path);
+                fail();
+            }
+            define_sym(u, w, f->name, 0, 0);
+            sym = &w->syms[w->sym_count - 1];
+            sym->is_global = 1;
+        }
+        int64_t pc_bias = (int64_t)f->offset - (int64_t)f->insn_end;
+        if (sym->section == f->section && f->kind != FIX_ABS64) {
+            int32_t rel = (int32_t)(sym->value - (long long)f->insn_end);
+            memcpy(sec->buf.data + f->offset, &rel, 4);
+            continue;
+        }
+        int type = f->kind == FIX_ABS64 ? R_X86_64_64 : f->kind == FIX_CALL && sym->section == 0 ? R_X86_64_PLT32 : R_X86_64_PC32;
+        int64_t addend = f->kind == FIX_ABS64 ? 0 : pc_bias;
+        ElfRela r = { .offset = f->offset };
+        if (sym->section == 0) {
+            r.addend = addend;
+            r.info = ((uint64_t)(sym - w->syms) << 32) | type;
+        } else {
+            r.addend = addend + sym->value;
+            r.info = ((uint64_t)(0x80000000 | sym->section) << 32) | type;
+        }
+        buf_put(&sec->rela, &r, sizeof(r));
+    }
+    for (int i = 0; i < w->sym_count; i++) {
+        w->syms[i].is_global |= global_declared(u, w->syms[i].name);
+    }
+
+    ByteBuf strtab = {0};
+    ByteBuf symtab = {0};
+    buf_byte(&strtab, 0);
+    elf_sym(&symtab, 0, 0, 0, 0);
+    for (int i = 1; i < w->sec_count; i++) elf_sym(&symtab, 0, 3, i, 0);
+    int index = w->sec_count;
+    int first_global = index;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < w->sym_count; i++) {
+            ObjSym* sym = &w->syms[i];
+            if (sym->is_global != pass) continue;
+            sym->index = index++;
+            elf_sym(&symtab, strtab.len, pass << 4, sym->section, sym->value);
+            buf_put(&strtab, sym->name, strlen(sym->name) + 1);
+        }
+        if (pass == 0) first_global = index;
+    }
+
+    ByteBuf shstrtab = {0};
+    ByteBuf body = {0};
+    ByteBuf shdrs = {0};
+    size_t off = 64;
+    buf_byte(&shstrtab, 0);
+    elf_shdr(&shdrs, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    int rela_count = 0;
+    for (int i = 1; i < w->sec_count; i++) {
+        if (w->secs[i].rela.len) w->secs[i].rela_index = w->sec_count + rela_count++;
+    }
+    int symtab_index = w->sec_count + rela_count;
+    for (int i = 1; i < w->sec_count; i++) {
+        ObjSection* sec = &w->secs[i];
+        int nobits = strncmp(sec->name, ".bss", 4) == 0;
+        int flags = sec->exec ? 6 : strncmp(sec->name, ".rodata", 7) == 0 ? 2 : 3;
+        buf_align(&body, 16);
+        elf_shdr(&shdrs, shstrtab.len, nobits ? 8 : 1, flags, off + body.len, sec->buf.len, 0, 0, sec->exec ? 16 : nobits ? 8 : 4, 0);
+        buf_put(&shstrtab, sec->name, strlen(sec->name) + 1);
+        if (!nobits) buf_put(&body, sec->buf.data, sec->buf.len);
+    }
+    for (int i = 1; i < w->sec_count; i++) {
+        ObjSection* sec = &w->secs[i];
+        if (!sec->rela.len) continue;
+        ElfRela* relas = (ElfRela*)sec->rela.data;
+        for (size_t j = 0; j < sec->rela.len / sizeof(ElfRela); j++) {
+            uint64_t sym = relas[j].info >> 32;
+            uint64_t elf_index = sym & 0x80000000 ? sym & 0x7FFFFFFF : (uint64_t)w->syms[sym].index;
+            relas[j].info = (elf_index << 32) | (relas[j].info & 0xFFFFFFFF);
+        }
+        buf_align(&body, 8);
+        elf_shdr(&shdrs, shstrtab.len, 4, 0x40, off + body.len, sec->rela.len, symtab_index, i, 8, 24);
+        buf_put(&shstrtab, ".rela", 5);
+        buf_put(&shstrtab, sec->name, strlen(sec->name) + 1);
+        buf_put(&body, sec->rela.data, sec->rela.len);
+    }
+    buf_align(&body, 8);
+    elf_shdr(&shdrs, shstrtab.len, 2, 0, off + body.len, symtab.len, symtab_index + 1, first_global, 8, 24);
+    buf_put(&shstrtab, ".symtab", 8);
+    buf_put(&body, symtab.data, symtab.len);
+    elf_shdr(&shdrs, shstrtab.len, 3, 0, off + body.len, strtab.len, 0, 0, 1, 0);
+    buf_put(&shstrtab, ".strtab", 8);
+    buf_put(&body, strtab.data, strtab.len);
+    elf_shdr(&shdrs, shstrtab.len, 1, 0, off + body.len, 0, 0, 0, 1, 0);
+    buf_put(&shstrtab, ".note.GNU-stack", 16);
+    elf_shdr(&shdrs, shstrtab.len, 3, 0, off + body.len, 0, 0, 0, 1, 0);
+    buf_put(&shstrtab, ".shstrtab", 10);
+    memcpy(shdrs.data + shdrs.len - 64 + 32, &(uint64_t){ shstrtab.len }, 8);
+    buf_put(&body, shstrtab.data, shstrtab.len);
+    buf_align(&body, 8);
+    int shnum = symtab_index + 4;
+
+    ByteBuf out = {0};
+    static const unsigned char ident[16] = { 0x7F, 'E', 'L', 'F', 2, 1, 1, 0 };
+    buf_put(&out, ident, 16);
+    buf_u16(&out, 1);
+    buf_u16(&out, 62);
+    buf_u32(&out, 1);
+    buf_u64(&out, 0);
+    buf_u64(&out, 0);
+    buf_u64(&out, off + body.len);
+    buf_u32(&out, 0);
+    buf_u16(&out, 64);
+    buf_u16(&out, 0);
+    buf_u16(&out, 0);
+    buf_u16(&out, 64);
+    buf_u16(&out, shnum);
+    buf_u16(&out, shnum - 1);
+    buf_put(&out, body.data, body.len);
+    buf_put(&out, shdrs.data, shdrs.len);
+
+    FILE* f = fopen(u->obj_path, "wb");
+    if (!f || fwrite(out.data, 1, out.len, f) != out.len) {
+        fprintf(stderr, "Error: Cannot write to %s\n", u->obj_path);
+        u->status = 1;
+    }
+    if (f) fclose(f);
+
+    free(strtab.data);
+    free(symtab.data);
+    free(shstrtab.data);
+    free(body.data);
+    free(shdrs.data);
+    free(out.data);
+}
+
+void write_elf_object(CompileUnit* u) {
+    ObjWriter w = { .sec_count = 1 };
+    obj_encode(u, &w);
+    obj_finish(u, &w);
+    obj_free(&w);
+}
+
+#define IR_REG_COUNT 5
+
+const int ir_regs[IR_REG_COUNT] = { REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15 };
+
+int ir_defines(IrInsn* ir) {
+    return ir->op == IR_CONST || ir->op == IR_ADDR || ir->op == IR_COPY || ir->op == IR_STRING;
+}
+
+const char* pool_literal(CompileUnit* u, const char** pool, uint32_t id, const char* prefix, char tail, int base) {
+    if (!pool[id]) {
+        StrEntry* e = &u->strs.entries[id];
+        char* bytes = arena_alloc(&u->arena, e->len + 1);
+        memcpy(bytes, e->str, e->len);
+        bytes[e->len] = tail;
+        pool[id] = unit_name(u, prefix, base + id);
+        asm_data(u, ".rodata", pool[id], bytes, e->len + 1);
+    }
+    return pool[id];
+}
+
+void lower_ir(CompileUnit* u) {
+    int* var_def = arena_alloc(&u->arena, u->strs.count * sizeof(int));
+    int* var_loop = arena_alloc(&u->arena, u->strs.count * sizeof(int));
+    int* carried = arena_alloc(&u->arena, u->ast_count * sizeof(int));
+    int* carried_def = arena_alloc(&u->arena, u->ast_count * sizeof(int));
+    const char** pool = arena_alloc(&u->arena, u->strs.count * sizeof(char*));
+    const char** strings = arena_alloc(&u->arena, u->strs.count * sizeof(char*));
+    int loop = -1;
+    int carried_count = 0;
+    int line = 1;
+    uint32_t scanned = 0;
+    for (int i = 0; i < u->strs.count; i++) {
+        var_def[i] = -1;
+        var_loop[i] = -1;
+        pool[i] = NULL;
+        strings[i] = NULL;
+    }
+    u->ir = arena_alloc(&u->arena, 2 * u->ast_count * sizeof(IrInsn));
+    u->ir_count = 0;
+    for (int i = 0; i < u->ast_count; i++) {
+        ASTNode* n = &u->ast[i];
+        IrInsn* ir = &u->ir[u->ir_count];
+        *ir = (IrInsn){ .op = IR_NOP, .arg = -1, .reg = -1, .slot = -1, .next = -1 };
+        while (scanned < n->pos) line += u->src[scanned++] == '\n';
+        ir->line = line;
+        int decl = n->type == AST_VARDECL || n->type == AST_VARCOPY || n->type == AST_VARSTR;
+        if (decl && loop >= 0 && var_loop[n->value] != loop) {
+            var_loop[n->value] = loop;
+            carried[carried_count] = n->value;
+            carried_def[carried_count++] = var_def[n->value];
+        }
+        if (n->type == AST_VARSTR) {
+            ir->op = IR_STRING;
+            ir->sym = pool_literal(u, strings, n->value2, "lit", '\0', 0);
+            ir->imm = u->strs.entries[n->value2].len;
+            var_def[n->value] = u->ir_count;
+        } else if (decl) {
+            const char* value2 = ast_str(u, n->value2);
+            char* end;
+            ir->imm = strtoll(value2, &end, 10);
+            if (n->type == AST_VARCOPY && var_def[n->value2] >= 0) {
+                ir->op = IR_COPY;
+                ir->arg = var_def[n->value2];
+                u->ir[ir->arg].uses++;
+            } else if (*end == '\0') {
+                ir->op = IR_CONST;
+            } else {
+                ir->op = IR_ADDR;
+                ir->sym = value2;
+            }
+            var_def[n->value] = u->ir_count;
+        } else if (n->type == AST_PRINT) {
+            ir->op = IR_PRINT;
+            ir->sym = pool_literal(u, pool, n->value, "str", '\n', 0);
+            ir->imm = u->strs.entries[n->value].len + 1;
+        } else if (n->type == AST_KBCHK) {
+            ir->op = IR_KBCHK;
+        } else if (n->type == AST_LOOP) {
+            ir->op = IR_LOOP;
+            ir->imm = n->value ? strtoll(ast_str(u, n->value), NULL, 10) : 0;
+            loop = u->ir_count;
+            carried_count = 0;
+        } else if (n->type == AST_LOOP_END) {
+            for (int k = 0; k < carried_count; k++) {
+                int head = carried_def[k];
+                int tail = var_def[carried[k]];
+                if (head < 0 || head == tail) continue;
+                ir->op = IR_MOVE;
+                ir->arg = tail;
+                ir->imm = head;
+                u->ir[tail].uses++;
+                u->ir[head].phi = 1;
+                ir = &u->ir[++u->ir_count];
+                *ir = (IrInsn){ .op = IR_NOP, .arg = -1, .reg = -1, .slot = -1, .next = -1 };
+            }
+            ir->op = IR_LOOP_END;
+            ir->imm = loop;
+            loop = -1;
+        } else {
+            continue;
+        }
+        u->ir_count++;
+    }
+}
+
+void ir_constprop(CompileUnit* u) {
+    for (int i = 0; i < u->ir_count; i++) {
+        IrInsn* ir = &u->ir[i];
+        if (ir->op != IR_COPY) continue;
+        IrInsn* src = &u->ir[ir->arg];
+        if (src->phi || (src->op != IR_CONST && src->op != IR_ADDR)) continue;
+        ir->op = src->op;
+        ir->imm = src->imm;
+        ir->sym = src->sym;
+        ir->arg = -1;
+        src->uses--;
+    }
+}
+
+void ir_dead_vars(CompileUnit* u) {
+    for (int i = u->ir_count - 1; i >= 0; i--) {
+        IrInsn* ir = &u->ir[i];
+        if (ir->op == IR_MOVE && u->ir[ir->imm].uses) continue;
+        if (ir->op != IR_MOVE && (!ir_defines(ir) || ir->uses)) continue;
+        if (ir->arg >= 0) u->ir[ir->arg].uses--;
+        ir->op = IR_NOP;
+    }
+}
+
+int ir_regalloc(CompileUnit* u, int* saved) {
+    int n = u->ir_count;
+    int* ends = arena_alloc(&u->arena, (n + 1) * sizeof(int));
+    int* free_slots = arena_alloc(&u->arena, (n + 1) * sizeof(int));
+    int active[IR_REG_COUNT];
+    int free_count = 0;
+    int slots = 0;
+    *saved = 0;
+    for (int r = 0; r < IR_REG_COUNT; r++) active[r] = -1;
+    for (int i = 0; i <= n; i++) ends[i] = -1;
+    int* loop_end = arena_alloc(&u->arena, (n + 1) * sizeof(int));
+    for (int i = 0, loop = -1; i < n; i++) {
+        IrInsn* ir = &u->ir[i];
+        if (ir_defines(ir)) ir->end = opt_level > 0 ? i : n;
+        if (ir->arg >= 0 && opt_level > 0) u->ir[ir->arg].end = i;
+        if (ir->op == IR_MOVE && opt_level > 0) u->ir[ir->imm].end = i;
+        if (ir->op == IR_LOOP) loop = i;
+        loop_end[i] = -1;
+        if (ir->op == IR_LOOP_END) {
+            for (int k = loop; k <= i; k++) loop_end[k] = i;
+            loop = -1;
+        }
+    }
+    for (int i = 0; i < n && opt_level > 0; i++) {
+        IrInsn* ir = &u->ir[i];
+        if (!ir_defines(ir) || ir->end >= n) continue;
+        int e = loop_end[ir->end];
+        if (e >= 0 && u->ir[e].imm > i) ir->end = e;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int v = ends[i]; v >= 0; v = u->ir[v].next) {
+            IrInsn* e = &u->ir[v];
+            if (e->slot >= 0) free_slots[free_count++] = e->slot;
+            else active[e->reg] = -1;
+        }
+        IrInsn* ir = &u->ir[i];
+        if (!ir_defines(ir)) continue;
+        int r = 0;
+        while (r < IR_REG_COUNT && active[r] >= 0) r++;
+        if (r == IR_REG_COUNT) {
+            int victim = 0;
+            for (int k = 1; k < IR_REG_COUNT; k++) {
+                if (u->ir[active[k]].end > u->ir[active[victim]].end) victim = k;
+            }
+            IrInsn* spill = ir;
+            if (u->ir[active[victim]].end > ir->end) {
+                spill = &u->ir[active[victim]];
+                active[victim] = -1;
+                r = victim;
+            }
+            spill->reg = -1;
+            spill->slot = free_count ? free_slots[--free_count] : slots++;
+        }
+        if (r < IR_REG_COUNT) {
+            ir->reg = r;
+            active[r] = i;
+            *saved |= 1 << r;
+        }
+        ir->next = ends[ir->end];
+        ends[ir->end] = i;
+    }
+    return slots;
+}
+
+void ir_store(CompileUnit* u, IrInsn* ir, int reg, int base) {
+    if (ir->slot >= 0) asm_store_reg(u, -8 * (base + ir->slot + 1), reg);
+}
+
+int ir_home(IrInsn* ir) {
+    return ir->slot >= 0 ? REG_RAX : ir_regs[ir->reg];
+}
+
+void ir_copy(CompileUnit* u, IrInsn* ir, IrInsn* src, int base) {
+    int reg = ir_home(ir);
+    if (src->slot >= 0) {
+        asm_load_reg(u, reg, -8 * (base + src->slot + 1));
+    } else if (ir->slot >= 0) {
+        reg = ir_regs[src->reg];
+    } else if (src->reg != ir->reg) {
+        asm_reg_reg(u, INSN_MOV_RR, reg, ir_regs[src->reg]);
+    }
+    ir_store(u, ir, reg, base);
+}
+
+void ir_value(CompileUnit* u, IrInsn* ir, int base) {
+    int reg = ir_home(ir);
+    if (ir->op == IR_CONST) {
+        if (ir->slot >= 0 && ir->imm >= INT32_MIN && ir->imm <= INT32_MAX) {
+            asm_store_imm(u, -8 * (base + ir->slot + 1), ir->imm);
+            return;
+        }
+        asm_reg_imm(u, INSN_MOV_RI, reg, ir->imm);
+    } else if (ir->op == IR_ADDR) {
+        asm_reg_sym(u, INSN_MOV_RSYM, reg, ir->sym);
+    } else if (ir->op == IR_STRING) {
+        asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, ir->sym);
+        asm_reg_imm(u, INSN_MOV_RI, REG_RDX, ir->imm);
+        asm_sym(u, INSN_CALL, "arena_str");
+        if (ir->slot < 0) asm_reg_reg(u, INSN_MOV_RR, reg, REG_RAX);
+    } else {
+        ir_copy(u, ir, &u->ir[ir->arg], base);
+        return;
+    }
+    ir_store(u, ir, reg, base);
+}
+
+void emit_print_runtime(CompileUnit* u) {
+    asm_section(u, ".text" RUNTIME_SECTION "print");
+    asm_label(u, "print");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "out_len");
+    asm_load_mem(u, REG_RAX, REG_R8, 0);
+    asm_reg_reg(u, INSN_ADD_RR, REG_RAX, REG_RDX);
+    asm_reg_imm(u, INSN_CMP_RI, REG_RAX, PRINT_BUFFER);
+    asm_sym(u, INSN_JBE, ".copy");
+    asm_reg(u, INSN_PUSH, REG_RSI);
+    asm_reg(u, INSN_PUSH, REG_RDX);
+    asm_sym(u, INSN_CALL, "flush");
+    asm_reg(u, INSN_POP, REG_RDX);
+    asm_reg(u, INSN_POP, REG_RSI);
+    asm_reg_imm(u, INSN_CMP_RI, REG_RDX, PRINT_BUFFER);
+    asm_sym(u, INSN_JBE, ".copy");
+    asm_sym(u, INSN_JMP, "write_all");
+    asm_label(u, ".copy");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "out_len");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RDI, "out_buf");
+    asm_load_mem(u, REG_RAX, REG_R8, 0);
+    asm_reg_reg(u, INSN_ADD_RR, REG_RDI, REG_RAX);
+    asm_reg_reg(u, INSN_ADD_RR, REG_RAX, REG_RDX);
+    asm_store_mem(u, REG_R8, 0, REG_RAX);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RCX, REG_RDX);
+    asm_op(u, INSN_REP_MOVSB);
+    asm_op(u, INSN_RET);
+
+    asm_section(u, ".text" RUNTIME_SECTION "flush");
+    asm_label(u, "flush");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "out_len");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, "out_buf");
+    asm_load_mem(u, REG_RDX, REG_R8, 0);
+    emit_insn(u, (Insn){ .op = INSN_STORE_MI, .reg = REG_R8, .disp = 0, .imm = 0 });
+    asm_label(u, "write_all");
+    u->backend->emit_write_all(u);
+}
+
+void posix_write_all(CompileUnit* u) {
+    const Backend* b = u->backend;
+    asm_reg_reg(u, INSN_MOV_RR, REG_R9, REG_RDX);
+    asm_label(u, ".loop");
+    asm_reg_reg(u, INSN_TEST_RR, REG_R9, REG_R9);
+    asm_sym(u, INSN_JZ, ".done");
+    asm_reg_reg(u, INSN_MOV_RR, REG_RDX, REG_R9);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RAX, b->sys_write);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RDI, 1);
+    asm_op(u, INSN_SYSCALL);
+    if (b->carry_errors) asm_sym(u, INSN_JB, ".done");
+    asm_reg_reg(u, INSN_TEST_RR, REG_RAX, REG_RAX);
+    asm_sym(u, INSN_JLE, ".done");
+    asm_reg_reg(u, INSN_ADD_RR, REG_RSI, REG_RAX);
+    asm_reg_reg(u, INSN_SUB_RR, REG_R9, REG_RAX);
+    asm_sym(u, INSN_JMP, ".loop");
+    asm_label(u, ".done");
+    asm_op(u, INSN_RET);
+}
+
+void win_write_all(CompileUnit* u) {
+    asm_reg(u, INSN_PUSH, REG_RBP);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RBP, REG_RSP);
+    asm_reg_imm(u, INSN_AND_RI, REG_RSP, -16);
+    asm_reg_imm(u, INSN_SUB_RI, REG_RSP, 32);
+    asm_reg_reg(u, INSN_MOV_RR, REG_R8, REG_RDX);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RDX, REG_RSI);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RCX, 1);
+    asm_sym(u, INSN_CALL, "_write");
+    asm_reg_reg(u, INSN_MOV_RR, REG_RSP, REG_RBP);
+    asm_reg(u, INSN_POP, REG_RBP);
+    asm_op(u, INSN_RET);
+}
+
+void emit_kbhit_runtime(CompileUnit* u) {
+    asm_section(u, ".text" RUNTIME_SECTION "kbhit");
+    asm_label(u, "kbhit");
+    u->backend->emit_kbhit(u);
+}
+
+void posix_kbhit(CompileUnit* u) {
+    const Backend* b = u->backend;
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "key_head");
+    asm_load_mem(u, REG_RAX, REG_R8, 0);
+    asm_load_mem(u, REG_RCX, REG_R8, 8);
+    asm_reg_reg(u, INSN_CMP_RR, REG_RAX, REG_RCX);
+    asm_sym(u, INSN_JB, ".pop");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RDI, "key_poll");
+    asm_reg_imm(u, INSN_MOV_RI, REG_RSI, 1);
+    asm_reg_reg(u, INSN_XOR_RR, REG_RDX, REG_RDX);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RAX, b->sys_poll);
+    asm_op(u, INSN_SYSCALL);
+    if (b->carry_errors) asm_sym(u, INSN_JB, ".no_key");
+    asm_reg_reg(u, INSN_TEST_RR, REG_RAX, REG_RAX);
+    asm_sym(u, INSN_JLE, ".no_key");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "key_head");
+    asm_load_mem(u, REG_RCX, REG_R8, 8);
+    asm_reg_imm(u, INSN_AND_RI, REG_RCX, KEY_RING - 1);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, "key_ring");
+    asm_reg_reg(u, INSN_ADD_RR, REG_RSI, REG_RCX);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RDX, KEY_RING);
+    asm_reg_reg(u, INSN_SUB_RR, REG_RDX, REG_RCX);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RAX, b->sys_read);
+    asm_reg_reg(u, INSN_XOR_RR, REG_RDI, REG_RDI);
+    asm_op(u, INSN_SYSCALL);
+    if (b->carry_errors) asm_sym(u, INSN_JB, ".no_key");
+    asm_reg_reg(u, INSN_TEST_RR, REG_RAX, REG_RAX);
+    asm_sym(u, INSN_JLE, ".no_key");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "key_head");
+    asm_load_mem(u, REG_RCX, REG_R8, 8);
+    asm_reg_reg(u, INSN_ADD_RR, REG_RCX, REG_RAX);
+    asm_store_mem(u, REG_R8, 8, REG_RCX);
+    asm_load_mem(u, REG_RAX, REG_R8, 0);
+    asm_label(u, ".pop");
+    asm_reg_reg(u, INSN_MOV_RR, REG_RCX, REG_RAX);
+    asm_reg_imm(u, INSN_AND_RI, REG_RCX, KEY_RING - 1);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, "key_ring");
+    asm_reg_reg(u, INSN_ADD_RR, REG_RSI, REG_RCX);
+    asm_reg_imm(u, INSN_ADD_RI, REG_RAX, 1);
+    asm_store_mem(u, REG_R8, 0, REG_RAX);
+    emit_insn(u, (Insn){ .op = INSN_LOAD8_RM, .reg = REG_RAX, .reg2 = REG_RSI, .disp = 0 });
+    asm_reg_sym(u, INSN_STORE8_SYM, REG_RAX, "input_buf");
+    asm_reg_imm(u, INSN_MOV_RI, REG_RAX, 1);
+    asm_op(u, INSN_RET);
+    asm_label(u, ".no_key");
+    asm_reg_reg(u, INSN_XOR_RR, REG_RAX, REG_RAX);
+    asm_op(u, INSN_RET);
+}
+
+void win_kbhit(CompileUnit* u) {
+    asm_reg_imm(u, INSN_SUB_RI, REG_RSP, 40);
+    asm_sym(u, INSN_CALL, "_kbhit");
+    asm_reg_imm(u, INSN_CMP8_RI, REG_RAX, 0);
+    asm_sym(u, INSN_JE, ".no_key");
+    asm_sym(u, INSN_CALL, "_getch");
+    asm_reg_sym(u, INSN_STORE8_SYM, REG_RAX, "input_buf");
+    asm_reg_imm(u, INSN_MOV_RI, REG_RAX, 1);
+    asm_reg_imm(u, INSN_ADD_RI, REG_RSP, 40);
+    asm_op(u, INSN_RET);
+    asm_label(u, ".no_key");
+    asm_reg_reg(u, INSN_XOR_RR, REG_RAX, REG_RAX);
+    asm_reg_imm(u, INSN_ADD_RI, REG_RSP, 40);
+    asm_op(u, INSN_RET);
+}
+
+void emit_tty_ioctl(CompileUnit* u, long long request, const char* termios) {
+    asm_reg_imm(u, INSN_MOV_RI, REG_RAX, u->backend->sys_ioctl);
+    asm_reg_reg(u, INSN_XOR_RR, REG_RDI, REG_RDI);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RSI, request);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RDX, termios);
+    asm_op(u, INSN_SYSCALL);
+}
+
+const int tty_signals[2] = { TARGET_SIGINT, TARGET_SIGTERM };
+
+void posix_tty(CompileUnit* u) {
+    const Backend* b = u->backend;
+    asm_section(u, ".text" RUNTIME_SECTION "tty");
+    asm_label(u, "tty_init");
+    emit_tty_ioctl(u, b->tcgets, "tty_saved");
+    asm_reg_reg(u, INSN_TEST_RR, REG_RAX, REG_RAX);
+    asm_sym(u, INSN_JNZ, ".done");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, "tty_saved");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RDI, "tty_raw");
+    asm_reg_imm(u, INSN_MOV_RI, REG_RCX, TERMIOS_SIZE);
+    asm_op(u, INSN_REP_MOVSB);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "tty_raw");
+    asm_load_mem(u, REG_RAX, REG_R8, b->lflag_offset);
+    asm_reg_imm(u, INSN_AND_RI, REG_RAX, ~b->lflag_raw);
+    asm_store_mem(u, REG_R8, b->lflag_offset, REG_RAX);
+    emit_tty_ioctl(u, b->tcsets, "tty_raw");
+    asm_reg_reg(u, INSN_TEST_RR, REG_RAX, REG_RAX);
+    asm_sym(u, INSN_JNZ, ".done");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "tty_active");
+    emit_insn(u, (Insn){ .op = INSN_STORE_MI, .reg = REG_R8, .disp = 0, .imm = 1 });
+    if (b->sys_sigaction) {
+        asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "tty_action");
+        asm_reg_sym(u, INSN_LEA_RSYM, REG_RAX, "tty_signal");
+        asm_store_mem(u, REG_R8, 0, REG_RAX);
+        emit_insn(u, (Insn){ .op = INSN_STORE_MI, .reg = REG_R8, .disp = 8, .imm = TARGET_SA_RESTORER });
+        asm_reg_sym(u, INSN_LEA_RSYM, REG_RAX, "tty_sigreturn");
+        asm_store_mem(u, REG_R8, 16, REG_RAX);
+        for (int i = 0; i < 2; i++) {
+            asm_reg_imm(u, INSN_MOV_RI, REG_RAX, b->sys_sigaction);
+            asm_reg_imm(u, INSN_MOV_RI, REG_RDI, tty_signals[i]);
+            asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, "tty_action");
+            asm_reg_reg(u, INSN_XOR_RR, REG_RDX, REG_RDX);
+            asm_reg_imm(u, INSN_MOV_RI, REG_R10, 8);
+            asm_op(u, INSN_SYSCALL);
+        }
+    }
+    asm_label(u, ".done");
+    asm_op(u, INSN_RET);
+
+    asm_label(u, "tty_restore");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "tty_active");
+    asm_load_mem(u, REG_RAX, REG_R8, 0);
+    asm_reg_reg(u, INSN_TEST_RR, REG_RAX, REG_RAX);
+    asm_sym(u, INSN_JZ, ".done");
+    emit_tty_ioctl(u, b->tcsets, "tty_saved");
+    asm_label(u, ".done");
+    asm_op(u, INSN_RET);
+
+    if (b->sys_sigaction) {
+        asm_label(u, "tty_signal");
+        asm_reg(u, INSN_PUSH, REG_RDI);
+        asm_sym(u, INSN_CALL, "tty_restore");
+        asm_reg(u, INSN_POP, REG_RDI);
+        asm_reg_imm(u, INSN_ADD_RI, REG_RDI, 128);
+        asm_reg_imm(u, INSN_MOV_RI, REG_RAX, b->sys_exit);
+        asm_op(u, INSN_SYSCALL);
+
+        asm_label(u, "tty_sigreturn");
+        asm_reg_imm(u, INSN_MOV_RI, REG_RAX, b->sys_sigreturn);
+        asm_op(u, INSN_SYSCALL);
+    }
+}
+
+void emit_tick_runtime(CompileUnit* u) {
+    asm_section(u, ".text" RUNTIME_SECTION "tick");
+    u->backend->emit_tick(u);
+}
+
+void posix_tick(CompileUnit* u) {
+    const Backend* b = u->backend;
+    asm_label(u, "tick_start");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, "tick_deadline");
+    asm_sym(u, INSN_JMP, "tick_clock");
+
+    asm_label(u, "tick_wait");
+    asm_reg(u, INSN_PUSH, REG_RDI);
+    asm_reg(u, INSN_PUSH, REG_RSI);
+    asm_sym(u, INSN_CALL, "flush");
+    asm_reg(u, INSN_POP, REG_RSI);
+    asm_reg(u, INSN_POP, REG_RDI);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "tick_deadline");
+    asm_load_mem(u, REG_RAX, REG_R8, 8);
+    asm_reg_reg(u, INSN_ADD_RR, REG_RAX, REG_RSI);
+    asm_load_mem(u, REG_RDX, REG_R8, 0);
+    asm_reg_reg(u, INSN_ADD_RR, REG_RDX, REG_RDI);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RCX, 1000000000);
+    asm_reg_reg(u, INSN_CMP_RR, REG_RAX, REG_RCX);
+    asm_sym(u, INSN_JB, ".normal");
+    asm_reg_reg(u, INSN_SUB_RR, REG_RAX, REG_RCX);
+    asm_reg_imm(u, INSN_ADD_RI, REG_RDX, 1);
+    asm_label(u, ".normal");
+    asm_store_mem(u, REG_R8, 0, REG_RDX);
+    asm_store_mem(u, REG_R8, 8, REG_RAX);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, "tick_now");
+    asm_sym(u, INSN_CALL, "tick_clock");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "tick_deadline");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R9, "tick_now");
+    asm_load_mem(u, REG_RAX, REG_R8, 0);
+    asm_load_mem(u, REG_RCX, REG_R9, 0);
+    asm_reg_reg(u, INSN_CMP_RR, REG_RCX, REG_RAX);
+    asm_sym(u, INSN_JB, ".sleep");
+    asm_reg_reg(u, INSN_CMP_RR, REG_RAX, REG_RCX);
+    asm_sym(u, INSN_JB, ".late");
+    asm_load_mem(u, REG_RAX, REG_R8, 8);
+    asm_load_mem(u, REG_RCX, REG_R9, 8);
+    asm_reg_reg(u, INSN_CMP_RR, REG_RCX, REG_RAX);
+    asm_sym(u, INSN_JBE, ".sleep");
+    asm_label(u, ".late");
+    asm_load_mem(u, REG_RAX, REG_R9, 0);
+    asm_store_mem(u, REG_R8, 0, REG_RAX);
+    asm_load_mem(u, REG_RAX, REG_R9, 8);
+    asm_store_mem(u, REG_R8, 8, REG_RAX);
+    asm_op(u, INSN_RET);
+    asm_label(u, ".sleep");
+    asm_reg_imm(u, INSN_MOV_RI, REG_RAX, b->sys_clock_nanosleep);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RDI, b->clock_monotonic);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RSI, 1);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RDX, "tick_deadline");
+    asm_reg_reg(u, INSN_XOR_RR, REG_R10, REG_R10);
+    asm_op(u, INSN_SYSCALL);
+    asm_op(u, INSN_RET);
+
+    asm_label(u, "tick_clock");
+    asm_reg_imm(u, INSN_MOV_RI, REG_RAX, b->sys_clock_gettime);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RDI, b->clock_monotonic);
+    asm_op(u, INSN_SYSCALL);
+    asm_op(u, INSN_RET);
+}
+
+void darwin_tick(CompileUnit* u) {
+    asm_label(u, "tick_wait");
+    asm_reg(u, INSN_PUSH, REG_RDI);
+    asm_reg(u, INSN_PUSH, REG_RSI);
+    asm_sym(u, INSN_CALL, "flush");
+    asm_reg(u, INSN_POP, REG_RSI);
+    asm_reg(u, INSN_POP, REG_RDI);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "tick_deadline");
+    asm_store_mem(u, REG_R8, 0, REG_RDI);
+    asm_store_mem(u, REG_R8, 8, REG_RSI);
+    asm_reg(u, INSN_PUSH, REG_RBP);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RBP, REG_RSP);
+    asm_reg_imm(u, INSN_AND_RI, REG_RSP, -16);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RDI, REG_R8);
+    asm_reg_reg(u, INSN_XOR_RR, REG_RSI, REG_RSI);
+    asm_sym(u, INSN_CALL, "_nanosleep");
+    asm_reg_reg(u, INSN_MOV_RR, REG_RSP, REG_RBP);
+    asm_reg(u, INSN_POP, REG_RBP);
+    asm_op(u, INSN_RET);
+}
+
+void win_tick(CompileUnit* u) {
+    asm_label(u, "tick_wait");
+    asm_reg(u, INSN_PUSH, REG_RDI);
+    asm_sym(u, INSN_CALL, "flush");
+    asm_reg(u, INSN_POP, REG_RCX);
+    asm_reg(u, INSN_PUSH, REG_RBP);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RBP, REG_RSP);
+    asm_reg_imm(u, INSN_AND_RI, REG_RSP, -16);
+    asm_reg_imm(u, INSN_SUB_RI, REG_RSP, 32);
+    asm_sym(u, INSN_CALL, "Sleep");
+    asm_reg_reg(u, INSN_MOV_RR, REG_RSP, REG_RBP);
+    asm_reg(u, INSN_POP, REG_RBP);
+    asm_op(u, INSN_RET);
+}
+
+void posix_loop_wait(CompileUnit* u, long long period) {
+    asm_reg_imm(u, INSN_MOV_RI, REG_RDI, period / 1000000000);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RSI, period % 1000000000);
+    asm_sym(u, INSN_CALL, "tick_wait");
+}
+
+void win_loop_wait(CompileUnit* u, long long period) {
+    asm_reg_imm(u, INSN_MOV_RI, REG_RDI, period < 1000000 ? 1 : period / 1000000);
+    asm_sym(u, INSN_CALL, "tick_wait");
+}
+
+void emit_arena_runtime(CompileUnit* u) {
+    static const char msg[] = "Error: out of arena memory\n";
+    asm_section(u, ".text" RUNTIME_SECTION "arena");
+    asm_label(u, "arena_init");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "arena_ptr");
+    asm_load_mem(u, REG_RAX, REG_R8, 0);
+    asm_reg_reg(u, INSN_TEST_RR, REG_RAX, REG_RAX);
+    asm_sym(u, INSN_JNZ, ".done");
+    u->backend->emit_arena_init(u);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "arena_ptr");
+    asm_store_mem(u, REG_R8, 0, REG_RAX);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RCX, u->config->arena_size);
+    asm_reg_reg(u, INSN_ADD_RR, REG_RAX, REG_RCX);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "arena_end");
+    asm_store_mem(u, REG_R8, 0, REG_RAX);
+    asm_label(u, ".done");
+    asm_op(u, INSN_RET);
+
+    asm_label(u, "arena_str");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "arena_ptr");
+    asm_load_mem(u, REG_RAX, REG_R8, 0);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R9, "arena_end");
+    asm_load_mem(u, REG_R9, REG_R9, 0);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RCX, REG_RDX);
+    asm_reg_imm(u, INSN_ADD_RI, REG_RCX, 16);
+    asm_reg_imm(u, INSN_AND_RI, REG_RCX, -8);
+    asm_reg_reg(u, INSN_ADD_RR, REG_RCX, REG_RAX);
+    asm_reg_reg(u, INSN_CMP_RR, REG_R9, REG_RCX);
+    asm_sym(u, INSN_JB, "arena_fail");
+    asm_store_mem(u, REG_R8, 0, REG_RCX);
+    asm_store_mem(u, REG_RAX, 0, REG_RDX);
+    asm_reg_imm(u, INSN_ADD_RI, REG_RAX, 8);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RDI, REG_RAX);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RCX, REG_RDX);
+    asm_reg_imm(u, INSN_ADD_RI, REG_RCX, 1);
+    asm_op(u, INSN_REP_MOVSB);
+    asm_op(u, INSN_RET);
+
+    asm_label(u, "arena_fail");
+    u->backend->emit_arena_fail(u, sizeof(msg) - 1);
+    asm_data(u, ".rodata" RUNTIME_SECTION "arena", "arena_msg", msg, sizeof(msg) - 1);
+}
+
+void posix_arena_init(CompileUnit* u) {
+    const Backend* b = u->backend;
+    long long flags = 2 | b->map_anon;
+    if (u->config->arena_hints & ARENA_POPULATE) flags |= b->map_populate;
+    if (u->config->arena_hints & ARENA_HUGE) flags |= b->map_huge;
+    asm_reg_imm(u, INSN_MOV_RI, REG_RAX, b->sys_mmap);
+    asm_reg_reg(u, INSN_XOR_RR, REG_RDI, REG_RDI);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RSI, u->config->arena_size);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RDX, 3);
+    asm_reg_imm(u, INSN_MOV_RI, REG_R10, flags);
+    asm_reg_imm(u, INSN_MOV_RI, REG_R8, -1);
+    asm_reg_reg(u, INSN_XOR_RR, REG_R9, REG_R9);
+    asm_op(u, INSN_SYSCALL);
+    if (b->carry_errors) asm_sym(u, INSN_JB, "arena_fail");
+    asm_reg_reg(u, INSN_TEST_RR, REG_RAX, REG_RAX);
+    asm_sym(u, INSN_JLE, "arena_fail");
+    if ((u->config->arena_hints & ARENA_HUGE) && b->sys_madvise) {
+        asm_reg(u, INSN_PUSH, REG_RAX);
+        asm_reg_reg(u, INSN_MOV_RR, REG_RDI, REG_RAX);
+        asm_reg_imm(u, INSN_MOV_RI, REG_RAX, b->sys_madvise);
+        asm_reg_imm(u, INSN_MOV_RI, REG_RSI, u->config->arena_size);
+        asm_reg_imm(u, INSN_MOV_RI, REG_RDX, 14);
+        asm_op(u, INSN_SYSCALL);
+        asm_reg(u, INSN_POP, REG_RAX);
+    }
+}
+
+void posix_arena_fail(CompileUnit* u, long long msg_len) {
+    asm_sym(u, INSN_CALL, "flush");
+    asm_reg_imm(u, INSN_MOV_RI, REG_RAX, u->backend->sys_write);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RDI, 2);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, "arena_msg");
+    asm_reg_imm(u, INSN_MOV_RI, REG_RDX, msg_len);
+    asm_op(u, INSN_SYSCALL);
+    asm_sym(u, INSN_CALL, "tty_restore");
+    asm_reg_imm(u, INSN_MOV_RI, REG_RAX, u->backend->sys_exit);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RDI, 1);
+    asm_op(u, INSN_SYSCALL);
+}
+
+void win_arena_init(CompileUnit* u) {
+    asm_reg(u, INSN_PUSH, REG_RBP);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RBP, REG_RSP);
+    asm_reg_imm(u, INSN_AND_RI, REG_RSP, -16);
+    asm_reg_imm(u, INSN_SUB_RI, REG_RSP, 32);
+    asm_reg_reg(u, INSN_XOR_RR, REG_RCX, REG_RCX);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RDX, u->config->arena_size);
+    asm_reg_imm(u, INSN_MOV_RI, REG_R8, 0x3000);
+    asm_reg_imm(u, INSN_MOV_RI, REG_R9, 4);
+    asm_sym(u, INSN_CALL, "VirtualAlloc");
+    asm_reg_reg(u, INSN_MOV_RR, REG_RSP, REG_RBP);
+    asm_reg(u, INSN_POP, REG_RBP);
+    asm_reg_reg(u, INSN_TEST_RR, REG_RAX, REG_RAX);
+    asm_sym(u, INSN_JZ, "arena_fail");
+}
+
+void win_arena_fail(CompileUnit* u, long long msg_len) {
+    asm_reg_imm(u, INSN_AND_RI, REG_RSP, -16);
+    asm_reg_imm(u, INSN_SUB_RI, REG_RSP, 32);
+    asm_sym(u, INSN_CALL, "flush");
+    asm_reg_imm(u, INSN_MOV_RI, REG_RCX, 2);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RDX, "arena_msg");
+    asm_reg_imm(u, INSN_MOV_RI, REG_R8, msg_len);
+    asm_sym(u, INSN_CALL, "_write");
+    asm_reg_imm(u, INSN_MOV_RI, REG_RCX, 1);
+    asm_sym(u, INSN_CALL, "ExitProcess");
+}
+
+void emit_prof_runtime(CompileUnit* u) {
+    asm_section(u, ".text" RUNTIME_SECTION "prof");
+    asm_label(u, "prof_dump");
+    asm_reg(u, INSN_PUSH, REG_RBX);
+    asm_reg(u, INSN_PUSH, REG_R12);
+    asm_reg(u, INSN_PUSH, REG_R13);
+    asm_reg(u, INSN_PUSH, REG_R14);
+    asm_reg(u, INSN_PUSH, REG_R15);
+    asm_reg(u, INSN_PUSH, REG_RBP);
+    asm_reg_imm(u, INSN_SUB_RI, REG_RSP, 40);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RBX, REG_RDI);
+    asm_reg_reg(u, INSN_MOV_RR, REG_R12, REG_RSI);
+    asm_reg_reg(u, INSN_MOV_RR, REG_R13, REG_RDX);
+    asm_reg_reg(u, INSN_MOV_RR, REG_R14, REG_RCX);
+    asm_reg_reg(u, INSN_MOV_RR, REG_R15, REG_R8);
+    asm_label(u, ".entry");
+    asm_reg_reg(u, INSN_TEST_RR, REG_R13, REG_R13);
+    asm_sym(u, INSN_JZ, ".done");
+    asm_load_mem(u, REG_RAX, REG_RBX, 8);
+    asm_reg_reg(u, INSN_TEST_RR, REG_RAX, REG_RAX);
+    asm_sym(u, INSN_JZ, ".skip");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RDI, "prof_buf");
+    asm_reg_reg(u, INSN_MOV_RR, REG_RSI, REG_R14);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RCX, REG_R15);
+    asm_op(u, INSN_REP_MOVSB);
+    asm_load_mem(u, REG_RAX, REG_R12, 0);
+    asm_reg_reg(u, INSN_TEST_RR, REG_RAX, REG_RAX);
+    asm_sym(u, INSN_JZ, ".total");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, "prof_text");
+    asm_reg_imm(u, INSN_MOV_RI, REG_RCX, 1);
+    asm_op(u, INSN_REP_MOVSB);
+    asm_sym(u, INSN_CALL, "prof_num");
+    asm_label(u, ".total");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, "prof_text");
+    asm_reg_imm(u, INSN_MOV_RI, REG_RCX, 2);
+    asm_op(u, INSN_REP_MOVSB);
+    asm_load_mem(u, REG_RAX, REG_RBX, 0);
+    asm_sym(u, INSN_CALL, "prof_num");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, "prof_text");
+    asm_reg_imm(u, INSN_ADD_RI, REG_RSI, 2);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RCX, 9);
+    asm_op(u, INSN_REP_MOVSB);
+    asm_load_mem(u, REG_RAX, REG_RBX, 8);
+    asm_sym(u, INSN_CALL, "prof_num");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, "prof_text");
+    asm_reg_imm(u, INSN_ADD_RI, REG_RSI, 11);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RCX, 6);
+    asm_op(u, INSN_REP_MOVSB);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, "prof_buf");
+    asm_reg_reg(u, INSN_MOV_RR, REG_RDX, REG_RDI);
+    asm_reg_reg(u, INSN_SUB_RR, REG_RDX, REG_RSI);
+    u->backend->emit_write_err(u);
+    asm_label(u, ".skip");
+    asm_reg_imm(u, INSN_ADD_RI, REG_RBX, 16);
+    asm_reg_imm(u, INSN_ADD_RI, REG_R12, 8);
+    asm_reg_imm(u, INSN_SUB_RI, REG_R13, 1);
+    asm_sym(u, INSN_JMP, ".entry");
+    asm_label(u, ".done");
+    asm_reg_imm(u, INSN_ADD_RI, REG_RSP, 40);
+    asm_reg(u, INSN_POP, REG_RBP);
+    asm_reg(u, INSN_POP, REG_R15);
+    asm_reg(u, INSN_POP, REG_R14);
+    asm_reg(u, INSN_POP, REG_R13);
+    asm_reg(u, INSN_POP, REG_R12);
+    asm_reg(u, INSN_POP, REG_RBX);
+    asm_op(u, INSN_RET);
+
+    asm_label(u, "prof_num");
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R10, "prof_digits");
+    asm_reg_imm(u, INSN_ADD_RI, REG_R10, 24);
+    asm_reg_reg(u, INSN_MOV_RR, REG_R11, REG_R10);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RCX, 10);
+    asm_label(u, ".digit");
+    asm_reg_reg(u, INSN_XOR_RR, REG_RDX, REG_RDX);
+    asm_reg(u, INSN_DIV_R, REG_RCX);
+    asm_reg_imm(u, INSN_ADD_RI, REG_RDX, '0');
+    asm_reg_imm(u, INSN_SUB_RI, REG_R11, 1);
+    emit_insn(u, (Insn){ .op = INSN_STORE8_MR, .reg = REG_RDX, .reg2 = REG_R11, .disp = 0 });
+    asm_reg_reg(u, INSN_TEST_RR, REG_RAX, REG_RAX);
+    asm_sym(u, INSN_JNZ, ".digit");
+    asm_reg_reg(u, INSN_MOV_RR, REG_RSI, REG_R11);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RCX, REG_R10);
+    asm_reg_reg(u, INSN_SUB_RR, REG_RCX, REG_R11);
+    asm_op(u, INSN_REP_MOVSB);
+    asm_op(u, INSN_RET);
+    asm_data(u, ".rodata" RUNTIME_SECTION "prof", "prof_text", ":  cycles,  hits\n", 17);
+}
+
+void emit_prof_stamp(CompileUnit* u) {
+    asm_op(u, INSN_RDTSC);
+    asm_reg_imm(u, INSN_SHL_RI, REG_RDX, 32);
+    asm_reg_reg(u, INSN_OR_RR, REG_RAX, REG_RDX);
+}
+
+void emit_prof_begin(CompileUnit* u, const char* mark) {
+    emit_prof_stamp(u);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, mark);
+    asm_store_mem(u, REG_R8, 0, REG_RAX);
+}
+
+void emit_prof_end(CompileUnit* u, const char* mark, int entry) {
+    emit_prof_stamp(u);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, mark);
+    asm_load_mem(u, REG_RCX, REG_R8, 0);
+    asm_reg_reg(u, INSN_SUB_RR, REG_RAX, REG_RCX);
+    asm_reg_sym(u, INSN_LEA_RSYM, REG_R8, "prof_table");
+    asm_load_mem(u, REG_RCX, REG_R8, 16 * entry);
+    asm_reg_reg(u, INSN_ADD_RR, REG_RCX, REG_RAX);
+    asm_store_mem(u, REG_R8, 16 * entry, REG_RCX);
+    asm_load_mem(u, REG_RCX, REG_R8, 16 * entry + 8);
+    asm_reg_imm(u, INSN_ADD_RI, REG_RCX, 1);
+    asm_store_mem(u, REG_R8, 16 * entry + 8, REG_RCX);
+}
+
+void posix_declare_io(CompileUnit* u) {
+    asm_data(u, ".data" RUNTIME_SECTION "keys", "key_poll", "\0\0\0\0\1\0\0\0", 8);
+    asm_data(u, ".bss" RUNTIME_SECTION "keys", "key_head", NULL, 8);
+    asm_data(u, ".bss" RUNTIME_SECTION "keys", "key_tail", NULL, 8);
+    asm_data(u, ".bss" RUNTIME_SECTION "keys", "key_ring", NULL, KEY_RING);
+    asm_data(u, ".bss" RUNTIME_SECTION "tty", "tty_active", NULL, 8);
+    asm_data(u, ".bss" RUNTIME_SECTION "tty", "tty_action", NULL, 32);
+    asm_data(u, ".bss" RUNTIME_SECTION "tty", "tty_saved", NULL, TERMIOS_SIZE);
+    asm_data(u, ".bss" RUNTIME_SECTION "tty", "tty_raw", NULL, TERMIOS_SIZE);
+}
+
+void posix_write_err(CompileUnit* u) {
+    asm_reg_imm(u, INSN_MOV_RI, REG_RAX, u->backend->sys_write);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RDI, 2);
+    asm_op(u, INSN_SYSCALL);
+}
+
+void posix_exit(CompileUnit* u) {
+    asm_reg_imm(u, INSN_MOV_RI, REG_RAX, u->backend->sys_exit);
+    asm_reg_reg(u, INSN_XOR_RR, REG_RDI, REG_RDI);
+    asm_op(u, INSN_SYSCALL);
+}
+
+void darwin_exit(CompileUnit* u) {
+    asm_reg_imm(u, INSN_MOV_RI, REG_RAX, u->backend->sys_exit);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RDI, 0);
+    asm_op(u, INSN_SYSCALL);
+}
+
+void win_declare_io(CompileUnit* u) {
+    asm_extern(u, "_kbhit");
+    asm_extern(u, "_getch");
+    asm_extern(u, "_write");
+}
+
+void win_write_err(CompileUnit* u) {
+    asm_reg_reg(u, INSN_MOV_RR, REG_R8, REG_RDX);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RDX, REG_RSI);
+    asm_reg_imm(u, INSN_MOV_RI, REG_RCX, 2);
+    asm_sym(u, INSN_CALL, "_write");
+}
+
+void win_exit(CompileUnit* u) {
+    asm_reg_imm(u, INSN_MOV_RI, REG_RCX, 0);
+    asm_sym(u, INSN_CALL, "ExitProcess");
+}
+
+#define DARWIN_BACKEND(p, n, ld, main_libs) { \
+    .platform = p, .name = n, .nasm_format = "macho64", .entry = "_main", .carry_errors = 1, \
+    .sys_read = 0x2000003, .sys_write = 0x2000004, .sys_exit = 0x2000001, .sys_ioctl = 0x2000036, \
+    .sys_poll = 0x20000E6, .sys_mmap = 0x20000C5, .tcgets = 0x40487413, .tcsets = 0x80487414, \
+    .lflag_offset = 24, .lflag_raw = 0x108, .map_anon = 0x1000, .tick_extern = "_nanosleep", \
+    .ld_args = ld, .ld_out = "", .exe_suffix = "", .ld_main_libs = main_libs, .ld_libs = darwin_libs, \
+    .declare_io = posix_declare_io, .emit_write_all = posix_write_all, .emit_kbhit = posix_kbhit, \
+    .emit_tty = posix_tty, .emit_tick = darwin_tick, .emit_loop_wait = posix_loop_wait, \
+    .emit_arena_init = posix_arena_init, .emit_arena_fail = posix_arena_fail, \
+    .emit_write_err = posix_write_err, .emit_exit = darwin_exit }
+
+#define LINUX_BACKEND(p, n, builtin, main_libs, libs) { \
+    .platform = p, .name = n, .nasm_format = "elf64", .entry = "main", .elf = 1, .builtin_link = builtin, \
+    .sys_read = 0, .sys_write = 1, .sys_exit = 60, .sys_ioctl = 16, .sys_poll = 7, .sys_mmap = 9, \
+    .sys_madvise = 28, .sys_sigaction = 13, .sys_sigreturn = 15, .sys_clock_gettime = 228, .sys_clock_nanosleep = 230, \
+    .clock_monotonic = 1, .tcgets = 0x5401, .tcsets = 0x5402, .lflag_offset = 12, .lflag_raw = 0xA, \
+    .map_anon = 0x20, .map_populate = 0x8000, .tick_absolute = 1, \
+    .ld_args = unix_ld, .ld_out = "", .exe_suffix = "", .ld_main_libs = main_libs, .ld_libs = libs, \
+    .declare_io = posix_declare_io, .emit_write_all = posix_write_all, .emit_kbhit = posix_kbhit, \
+    .emit_tty = posix_tty, .emit_tick = posix_tick, .emit_loop_wait = posix_loop_wait, \
+    .emit_arena_init = posix_arena_init, .emit_arena_fail = posix_arena_fail, \
+    .emit_write_err = posix_write_err, .emit_exit = posix_exit }
+
+const char* const macos_ld[] = { "ld", "-w", "-platform_version", "macos", "10.15", "10.15", "-L/usr/lib", "-syslibroot",
+    "/Applications/Xcode.app/Contents/Developer/Platforms/MacOSX.platform/Developer/SDKs/MacOSX.sdk", "-o", NULL };
+const char* const unix_ld[] = { "ld", "-o", NULL };
+const char* const freebsd_ld[] = { "ld.bfd", "-o", NULL };
+const char* const windows_ld[] = { "link", NULL };
+const char* const ios_libs[] = { "-lSystem", "-syslibroot",
+    "/Applications/Xcode.app/Contents/Developer/Platforms/iPhoneOS.platform/Developer/SDKs/iPhoneOS.sdk", NULL };
+const char* const darwin_libs[] = { "-lSystem", NULL };
+const char* const libc_libs[] = { "-lc", NULL };
+const char* const windows_libs[] = { "msvcrt.lib", "kernel32.lib", NULL };
+const char* const no_libs[] = { NULL };
+
+const Backend backends[PLATFORM_COUNT] = {
+    [PLATFORM_MACOS] = DARWIN_BACKEND(PLATFORM_MACOS, "macos", macos_ld, no_libs),
+    [PLATFORM_IOS] = DARWIN_BACKEND(PLATFORM_IOS, "ios", unix_ld, ios_libs),
+    [PLATFORM_LINUX] = LINUX_BACKEND(PLATFORM_LINUX, "linux", 1, no_libs, no_libs),
+    [PLATFORM_ANDROID] = LINUX_BACKEND(PLATFORM_ANDROID, "android", 0, libc_libs, libc_libs),
+    [PLATFORM_FREEBSD] = {
+        .platform = PLATFORM_FREEBSD, .name = "freebsd", .nasm_format = "elf64", .entry = "main", .elf = 1,
+        .carry_errors = 1, .sys_read = 3, .sys_write = 4, .sys_exit = 1, .sys_ioctl = 54, .sys_poll = 209,
+        .sys_mmap = 477, .sys_clock_gettime = 232, .sys_clock_nanosleep = 244, .clock_monotonic = 4,
+        .tcgets = 0x402C7413, .tcsets = 0x802C7414, .lflag_offset = 12, .lflag_raw = 0x108,
+        .map_anon = 0x1000, .map_populate = 0x40000, .map_huge = 0x1000000, .tick_absolute = 1,
+        .ld_args = freebsd_ld, .ld_out = "", .exe_suffix = "", .ld_main_libs = no_libs, .ld_libs = libc_libs,
+        .declare_io = posix_declare_io, .emit_write_all = posix_write_all, .emit_kbhit = posix_kbhit,
+        .emit_tty = posix_tty, .emit_tick = posix_tick, .emit_loop_wait = posix_loop_wait,
+        .emit_arena_init = posix_arena_init, .emit_arena_fail = posix_arena_fail,
+        .emit_write_err = posix_write_err, .emit_exit = posix_exit },
+    [PLATFORM_WINDOWS] = {
+        .platform = PLATFORM_WINDOWS, .name = "windows", .nasm_format = "win64", .entry = "main",
+        .shadow_space = 32, .tick_extern = "Sleep", .alloc_extern = "VirtualAlloc", .exit_extern = "ExitProcess",
+        .ld_args = windows_ld, .ld_out = "/out:", .exe_suffix = ".exe", .ld_main_libs = windows_libs, .ld_libs = no_libs,
+        .declare_io = win_declare_io, .emit_write_all = win_write_all, .emit_kbhit = win_kbhit,
+        .emit_tick = win_tick, .emit_loop_wait = win_loop_wait,
+        .emit_arena_init = win_arena_init, .emit_arena_fail = win_arena_fail,
+        .emit_write_err = win_write_err, .emit_exit = win_exit }
+};
+
+void emit_runtime_data(CompileUnit* u, int paced, int strings) {
+    const Backend* b = u->backend;
+    asm_data(u, ".data" RUNTIME_SECTION "input_buf", "input_buf", "", 1);
+    asm_data(u, ".bss" RUNTIME_SECTION "out", "out_len", NULL, 8);
+    asm_data(u, ".bss" RUNTIME_SECTION "out", "out_buf", NULL, PRINT_BUFFER);
+    b->declare_io(u);
+    if (paced) asm_data(u, ".bss" RUNTIME_SECTION "tick", "tick_deadline", NULL, 16);
+    if (paced && b->tick_absolute) asm_data(u, ".bss" RUNTIME_SECTION "tick", "tick_now", NULL, 16);
+    if (paced && b->tick_extern) asm_extern(u, b->tick_extern);
+    if (strings) asm_data(u, ".bss" RUNTIME_SECTION "arena", "arena_ptr", NULL, 8);
+    if (strings) asm_data(u, ".bss" RUNTIME_SECTION "arena", "arena_end", NULL, 8);
+    if (strings && b->alloc_extern) asm_extern(u, b->alloc_extern);
+    if ((u->is_main || strings) && b->exit_extern) asm_extern(u, b->exit_extern);
+}
+
+void emit_runtime(CompileUnit* u, int paced, int strings) {
+    emit_kbhit_runtime(u);
+    if (u->backend->emit_tty) u->backend->emit_tty(u);
+    emit_print_runtime(u);
+    if (paced) emit_tick_runtime(u);
+    if (strings) emit_arena_runtime(u);
+}
+
+void emit_kbchk(CompileUnit* u, const char* no_input, const char* exit) {
+    asm_sym(u, INSN_CALL, "flush");
+    asm_sym(u, INSN_CALL, "kbhit");
+    asm_reg_reg(u, INSN_TEST_RR, REG_RAX, REG_RAX);
+    asm_sym(u, INSN_JZ, no_input);
+    asm_reg_sym(u, INSN_LOAD8_SYM, REG_RAX, "input_buf");
+    asm_reg_imm(u, INSN_CMP8_RI, REG_RAX, (unsigned char)u->config->exit_key[0]);
+    asm_sym(u, INSN_JE, exit);
+    asm_label(u, no_input);
+}
+
+void codegen(CompileUnit* u) {
+    const Backend* b = u->backend;
+    lower_ir(u);
+    if (opt_level > 0) {
+        ir_constprop(u);
+        ir_dead_vars(u);
+    }
+    int saved;
+    int slots = ir_regalloc(u, &saved);
+    if (u->is_main) saved = 0;
+    int base = 0;
+    for (int r = 0; r < IR_REG_COUNT; r++) base += saved >> r & 1;
+    int frame = (8 * (base + slots) + b->shadow_space + 15) & ~15;
+    int paced = 0;
+    int strings = 0;
+    int profile = u->is_main && strcmp(u->config->level, "profile") == 0;
+    int probes = 0;
+    int name_len = strlen(u->path) < PROF_NAME_MAX ? (int)strlen(u->path) : PROF_NAME_MAX;
+    for (int i = 0; i < u->ir_count; i++) {
+        paced |= u->ir[i].op == IR_LOOP && u->ir[i].imm;
+        strings |= u->ir[i].op == IR_STRING;
+        probes += ir_defines(&u->ir[i]) || u->ir[i].op == IR_PRINT || u->ir[i].op == IR_KBCHK;
+    }
+    if (profile) {
+        unsigned char* lines = arena_alloc(&u->arena, 8 * (probes + 1));
+        memset(lines, 0, 8 * (probes + 1));
+        for (int i = 0, k = 1; i < u->ir_count; i++) {
+            IrInsn* ir = &u->ir[i];
+            if (!ir_defines(ir) && ir->op != IR_PRINT && ir->op != IR_KBCHK) continue;
+            for (int b = 0; b < 4; b++) lines[8 * k + b] = (unsigned)ir->line >> (8 * b);
+            k++;
+        }
+        asm_data(u, ".bss", "prof_table", NULL, 16 * (probes + 1));
+        asm_data(u, ".bss", "prof_base", NULL, 8);
+        asm_data(u, ".bss", "prof_mark", NULL, 8);
+        asm_data(u, ".rodata", "prof_lines", (const char*)lines, 8 * (probes + 1));
+        asm_data(u, ".rodata", "prof_name", u->path, name_len);
+        asm_data(u, ".bss" RUNTIME_SECTION "prof", "prof_buf", NULL, PROF_NAME_MAX + 128);
+        asm_data(u, ".bss" RUNTIME_SECTION "prof", "prof_digits", NULL, 24);
+    }
+    emit_runtime_data(u, paced, strings);
+    if (u->is_main) asm_global(u, b->entry);
+
+    emit_runtime(u, paced, strings);
+    if (profile) emit_prof_runtime(u);
+
+    asm_section(u, ".text");
+    if (u->is_main) {
+        asm_label(u, b->entry);
+    } else {
+        asm_label(u, "module_init");
+    }
+    asm_reg(u, INSN_PUSH, REG_RBP);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RBP, REG_RSP);
+    if (frame) asm_reg_imm(u, INSN_SUB_RI, REG_RSP, frame);
+    for (int r = 0, k = 0; r < IR_REG_COUNT; r++) {
+        if (saved & (1 << r)) asm_store_reg(u, -8 * ++k, ir_regs[r]);
+    }
+    if (profile) emit_prof_begin(u, "prof_base");
+    if (u->is_main && b->emit_tty) asm_sym(u, INSN_CALL, "tty_init");
+    if (strings) asm_sym(u, INSN_CALL, "arena_init");
+
+    for (int i = 0, probe = 0; i < u->ir_count; i++) {
+        IrInsn* ir = &u->ir[i];
+        int statement = profile && (ir_defines(ir) || ir->op == IR_PRINT || ir->op == IR_KBCHK);
+        if (statement) emit_prof_begin(u, "prof_mark");
+        if (ir_defines(ir)) {
+            ir_value(u, ir, base);
+        } else if (ir->op == IR_PRINT) {
+            asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, ir->sym);
+            asm_reg_imm(u, INSN_MOV_RI, REG_RDX, ir->imm);
+            asm_sym(u, INSN_CALL, "print");
+        } else if (ir->op == IR_KBCHK) {
+            emit_kbchk(u, unit_name(u, ".no_input", i), ".exit");
+        } else if (ir->op == IR_MOVE) {
+            ir_copy(u, &u->ir[ir->imm], &u->ir[ir->arg], base);
+        } else if (ir->op == IR_LOOP) {
+            if (ir->imm && b->tick_absolute) asm_sym(u, INSN_CALL, "tick_start");
+            asm_label(u, unit_name(u, ".loop", i));
+        } else if (ir->op == IR_LOOP_END) {
+            long long period = u->ir[ir->imm].imm ? 1000000000 / u->ir[ir->imm].imm : 0;
+            if (period) b->emit_loop_wait(u, period);
+            asm_sym(u, INSN_JMP, unit_name(u, ".loop", ir->imm));
+        }
+        if (statement) emit_prof_end(u, "prof_mark", ++probe);
+    }
+
+    asm_label(u, ".exit");
+    if (profile) emit_prof_end(u, "prof_base", 0);
+    asm_sym(u, INSN_CALL, "flush");
+    if (profile) {
+        asm_reg_sym(u, INSN_LEA_RSYM, REG_RDI, "prof_table");
+        asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, "prof_lines");
+        asm_reg_imm(u, INSN_MOV_RI, REG_RDX, probes + 1);
+        asm_reg_sym(u, INSN_LEA_RSYM, REG_RCX, "prof_name");
+        asm_reg_imm(u, INSN_MOV_RI, REG_R8, name_len);
+        asm_sym(u, INSN_CALL, "prof_dump");
+    }
+    if (u->is_main && b->emit_tty) asm_sym(u, INSN_CALL, "tty_restore");
+    for (int r = 0, k = 0; r < IR_REG_COUNT; r++) {
+        if (saved & (1 << r)) asm_load_reg(u, ir_regs[r], -8 * ++k);
+    }
+    asm_reg_reg(u, INSN_MOV_RR, REG_RSP, REG_RBP);
+    asm_reg(u, INSN_POP, REG_RBP);
+    if (u->is_main) {
+        b->emit_exit(u);
+    } else {
+        asm_op(u, INSN_RET);
+    }
+}
+
+#define REG_BIT(r) (1u << (r))
+#define LIVE_FLAGS (1u << 16)
+#define LIVE_ALL 0x1FFFFu
+#define LIVE_PRESERVED (REG_BIT(REG_RBX) | REG_BIT(REG_RSP) | REG_BIT(REG_RBP) | REG_BIT(REG_R12) | REG_BIT(REG_R13) | REG_BIT(REG_R14) | REG_BIT(REG_R15))
+#define LIVE_ARGS (REG_BIT(REG_RAX) | REG_BIT(REG_RDI) | REG_BIT(REG_RSI) | REG_BIT(REG_RDX) | REG_BIT(REG_RCX) | REG_BIT(REG_R8) | REG_BIT(REG_R9))
+#define LIVE_SYSCALL_ARGS (REG_BIT(REG_RAX) | REG_BIT(REG_RDI) | REG_BIT(REG_RSI) | REG_BIT(REG_RDX) | REG_BIT(REG_R10) | REG_BIT(REG_R8) | REG_BIT(REG_R9))
+#define LIVE_CLOBBERED (LIVE_ARGS | REG_BIT(REG_R10) | REG_BIT(REG_R11) | LIVE_FLAGS)
+#define OPT_MAX_PASSES 8
+#define OPT_MAX_THREAD 8
+
+typedef struct {
+    int kind;
+    long long imm;
+    const char* sym;
+} RegValue;
+
+enum { VALUE_UNKNOWN, VALUE_IMM, VALUE_ADDR };
+
+void insn_regs(Insn* in, uint32_t* use, uint32_t* def) {
+    *use = 0;
+    *def = 0;
+    switch (in->op) {
+    case INSN_MOV_RI:
+    case INSN_MOV_RSYM:
+    case INSN_LEA_RSYM:
+        *def = REG_BIT(in->reg);
+        break;
+    case INSN_MOV_RR:
+        *use = REG_BIT(in->reg2);
+        *def = REG_BIT(in->reg);
+        break;
+    case INSN_STORE_MI:
+    case INSN_STORE8_SYM:
+        *use = REG_BIT(in->reg);
+        break;
+    case INSN_STORE_MR:
+    case INSN_STORE8_MR:
+        *use = REG_BIT(in->reg) | REG_BIT(in->reg2);
+        break;
+    case INSN_LOAD_RM:
+        *use = REG_BIT(in->reg2);
+        *def = REG_BIT(in->reg);
+        break;
+    case INSN_LOAD8_SYM:
+        *use = *def = REG_BIT(in->reg);
+        break;
+    case INSN_LOAD8_RM:
+        *use = REG_BIT(in->reg) | REG_BIT(in->reg2);
+        *def = REG_BIT(in->reg);
+        break;
+    case INSN_CMP_RI:
+    case INSN_CMP8_RI:
+        *use = REG_BIT(in->reg);
+        *def = LIVE_FLAGS;
+        break;
+    case INSN_TEST_RR:
+        *use = REG_BIT(in->reg) | REG_BIT(in->reg2);
+        *def = LIVE_FLAGS;
+        break;
+    case INSN_XOR_RR:
+        *use = in->reg == in->reg2 ? 0 : REG_BIT(in->reg) | REG_BIT(in->reg2);
+        *def = REG_BIT(in->reg) | LIVE_FLAGS;
+        break;
+    case INSN_ADD_RR:
+    case INSN_SUB_RR:
+    case INSN_OR_RR:
+        *use = REG_BIT(in->reg) | REG_BIT(in->reg2);
+        *def = REG_BIT(in->reg) | LIVE_FLAGS;
+        break;
+    case INSN_CMP_RR:
+        *use = REG_BIT(in->reg) | REG_BIT(in->reg2);
+        *def = LIVE_FLAGS;
+        break;
+    case INSN_ADD_RI:
+    case INSN_SUB_RI:
+    case INSN_AND_RI:
+    case INSN_SHL_RI:
+        *use = REG_BIT(in->reg);
+        *def = REG_BIT(in->reg) | LIVE_FLAGS;
+        break;
+    case INSN_DIV_R:
+        *use = REG_BIT(REG_RAX) | REG_BIT(REG_RDX) | REG_BIT(in->reg);
+        *def = REG_BIT(REG_RAX) | REG_BIT(REG_RDX) | LIVE_FLAGS;
+        break;
+    case INSN_RDTSC:
+        *def = REG_BIT(REG_RAX) | REG_BIT(REG_RDX);
+        break;
+    case INSN_REP_MOVSB:
+        *use = *def = REG_BIT(REG_RCX) | REG_BIT(REG_RSI) | REG_BIT(REG_RDI);
+        break;
+    case INSN_PUSH:
+        *use = REG_BIT(in->reg) | REG_BIT(REG_RSP);
+        *def = REG_BIT(REG_RSP);
+        break;
+    case INSN_POP:
+        *use = REG_BIT(REG_RSP);
+        *def = REG_BIT(in->reg) | REG_BIT(REG_RSP);
+        break;
+    case INSN_CALL:
+        *use = LIVE_ARGS | REG_BIT(REG_RSP);
+        *def = LIVE_CLOBBERED;
+        break;
+    case INSN_SYSCALL:
+        *use = LIVE_SYSCALL_ARGS;
+        *def = REG_BIT(REG_RAX) | REG_BIT(REG_RCX) | REG_BIT(REG_RDX) | REG_BIT(REG_R11) | LIVE_FLAGS;
+        break;
+    case INSN_RET:
+        *use = REG_BIT(REG_RAX) | LIVE_PRESERVED;
+        break;
+    case INSN_JE:
+    case INSN_JZ:
+    case INSN_JNZ:
+    case INSN_JB:
+    case INSN_JBE:
+    case INSN_JLE:
+        *use = LIVE_FLAGS;
+        break;
+    default:
+        break;
+    }
+}
+
+int insn_is_jump(Insn* in) {
+    return in->op == INSN_JMP || in->op == INSN_JE || in->op == INSN_JZ || in->op == INSN_JNZ || in->op == INSN_JB || in->op == INSN_JBE || in->op == INSN_JLE;
+}
+
+int insn_is_pure(Insn* in, uint32_t def) {
+    switch (in->op) {
+    case INSN_MOV_RI:
+    case INSN_MOV_RR:
+    case INSN_MOV_RSYM:
+    case INSN_LEA_RSYM:
+    case INSN_LOAD_RM:
+    case INSN_LOAD8_SYM:
+    case INSN_LOAD8_RM:
+    case INSN_XOR_RR:
+    case INSN_ADD_RR:
+    case INSN_SUB_RR:
+    case INSN_CMP_RR:
+    case INSN_OR_RR:
+    case INSN_ADD_RI:
+    case INSN_SUB_RI:
+    case INSN_AND_RI:
+    case INSN_SHL_RI:
+    case INSN_CMP_RI:
+    case INSN_CMP8_RI:
+    case INSN_TEST_RR:
+        return !(def & LIVE_PRESERVED);
+    default:
+        return 0;
+    }
+}
+
+int frame_slot(Insn* in) {
+    int base = in->op == INSN_STORE_MI ? in->reg : in->op == INSN_STORE_MR || in->op == INSN_LOAD_RM ? in->reg2 : -1;
+    if (base != REG_RBP || in->disp >= 0 || in->disp % 8 || in->disp < -8 * 64) return -1;
+    return -in->disp / 8 - 1;
+}
+
+int region_end(CompileUnit* u, int start) {
+    int i = start + 1;
+    while (i < u->insn_count) {
+        Insn* in = &u->insns[i];
+        if (in->op == INSN_SECTION || (in->op == INSN_LABEL && in->sym[0] != '.')) break;
+        i++;
+    }
+    return i;
+}
+
+void opt_targets(CompileUnit* u, int* target, uint32_t* ids, int* label_at) {
+    for (int start = 0; start < u->insn_count;) {
+        int end = region_end(u, start);
+        for (int i = start; i < end; i++) {
+            if (u->insns[i].op == INSN_LABEL) label_at[ids[i]] = i;
+        }
+        for (int i = start; i < end; i++) {
+            target[i] = insn_is_jump(&u->insns[i]) ? label_at[ids[i]] : -1;
+        }
+        for (int i = start; i < end; i++) {
+            if (u->insns[i].op == INSN_LABEL) label_at[ids[i]] = -1;
+        }
+        start = end;
+    }
+}
+
+int opt_liveness(CompileUnit* u, int* target, uint32_t* ids, char* dead, uint32_t* live_out, uint32_t* func_live) {
+    uint32_t* label_live = arena_alloc(&u->arena, u->insn_count * sizeof(uint32_t));
+    uint64_t* label_killed = arena_alloc(&u->arena, u->insn_count * sizeof(uint64_t));
+    uint32_t live = LIVE_ALL;
+    uint64_t killed = 0;
+    int changed = 0;
+    for (int i = u->insn_count - 1; i >= 0; i--) {
+        Insn* in = &u->insns[i];
+        int t = target[i];
+        live_out[i] = live;
+        if (dead[i]) continue;
+        if (in->op == INSN_SECTION || (in->op == INSN_LABEL && in->sym[0] != '.')) {
+            if (in->op == INSN_LABEL) func_live[ids[i]] = live;
+            live = LIVE_ALL;
+            killed = 0;
+            continue;
+        }
+        if (in->op == INSN_LABEL) {
+            label_live[i] = live;
+            label_killed[i] = killed;
+            continue;
+        }
+        if (insn_is_jump(in)) {
+            uint32_t target_live = t > i ? label_live[t] : LIVE_ALL;
+            uint64_t target_killed = t > i ? label_killed[t] : 0;
+            if (in->op == INSN_JMP) {
+                live = target_live;
+                killed = target_killed;
+            } else {
+                live |= target_live | LIVE_FLAGS;
+                killed &= target_killed;
+            }
+            continue;
+        }
+        int slot = frame_slot(in);
+        if (slot >= 0 && in->op != INSN_LOAD_RM) {
+            if (killed & (1ULL << slot)) {
+                dead[i] = 1;
+                changed = 1;
+                continue;
+            }
+            killed |= 1ULL << slot;
+        }
+        if (in->op == INSN_RET || (in->op == INSN_MOV_RR && in->reg == REG_RSP && in->reg2 == REG_RBP)) {
+            killed = ~0ULL;
+        }
+        uint32_t use, def;
+        insn_regs(in, &use, &def);
+        if (in->op == INSN_CALL) use = func_live[ids[i]] | REG_BIT(REG_RSP);
+        if (insn_is_pure(in, def) && !(def & live)) {
+            dead[i] = 1;
+            changed = 1;
+            continue;
+        }
+        if (in->op == INSN_LOAD_RM) killed &= slot >= 0 ? ~(1ULL << slot) : 0;
+        live = (live & ~def) | use;
+    }
+    return changed;
+}
+
+int opt_redundant(CompileUnit* u, char* dead, uint32_t* live_out) {
+    RegValue known[16];
+    int changed = 0;
+    memset(known, 0, sizeof(known));
+    for (int i = 0; i < u->insn_count; i++) {
+        Insn* in = &u->insns[i];
+        if (dead[i]) continue;
+        RegValue v = { VALUE_UNKNOWN, 0, NULL };
+        switch (in->op) {
+        case INSN_LABEL:
+        case INSN_SECTION:
+            memset(known, 0, sizeof(known));
+            continue;
+        case INSN_MOV_RI:
+            v = (RegValue){ VALUE_IMM, in->imm, NULL };
+            break;
+        case INSN_XOR_RR:
+            if (in->reg != in->reg2) break;
+            v = (RegValue){ VALUE_IMM, 0, NULL };
+            if (live_out[i] & LIVE_FLAGS) {
+                known[in->reg] = v;
+                continue;
+            }
+            break;
+        case INSN_MOV_RSYM:
+        case INSN_LEA_RSYM:
+            v = (RegValue){ VALUE_ADDR, 0, in->sym };
+            break;
+        case INSN_MOV_RR:
+            if (in->reg == in->reg2) {
+                dead[i] = 1;
+                changed = 1;
+                continue;
+            }
+            v = known[in->reg2];
+            break;
+        default: {
+            uint32_t use, def;
+            insn_regs(in, &use, &def);
+            for (int r = 0; r < 16; r++) {
+                if (def & REG_BIT(r)) known[r].kind = VALUE_UNKNOWN;
+            }
+            continue;
+        }
+        }
+        RegValue* k = &known[in->reg];
+        if (v.kind != VALUE_UNKNOWN && k->kind == v.kind && k->imm == v.imm
+            && (v.kind != VALUE_ADDR || strcmp(k->sym, v.sym) == 0)) {
+            dead[i] = 1;
+            changed = 1;
+            continue;
+        }
+        *k = v;
+    }
+    return changed;
+}
+
+int next_real(CompileUnit* u, char* dead, int i) {
+    while (i < u->insn_count && (dead[i] || (u->insns[i].op == INSN_LABEL && u->insns[i].sym[0] == '.'))) i++;
+    return i;
+}
+
+int opt_jumps(CompileUnit* u, int* target, uint32_t* ids, char* dead) {
+    int changed = 0;
+    for (int i = 0; i < u->insn_count; i++) {
+        Insn* in = &u->insns[i];
+        if (dead[i] || !insn_is_jump(in) || target[i] < 0) continue;
+        int t = target[i];
+        for (int hop = 0; hop < OPT_MAX_THREAD; hop++) {
+            int k = next_real(u, dead, t);
+            if (k >= u->insn_count || u->insns[k].op != INSN_JMP || target[k] < 0 || target[k] == t) break;
+            t = target[k];
+        }
+        while (t + 1 < u->insn_count && u->insns[t + 1].op == INSN_LABEL && u->insns[t + 1].sym[0] == '.') t++;
+        if (t != target[i]) {
+            in->sym = u->insns[t].sym;
+            ids[i] = ids[t];
+            target[i] = t;
+            changed = 1;
+        }
+        if (t > i && next_real(u, dead, i + 1) == next_real(u, dead, t)) {
+            dead[i] = 1;
+            changed = 1;
+        }
+    }
+    for (int i = 0; i < u->insn_count; i++) {
+        Insn* in = &u->insns[i];
+        if (dead[i] || (in->op != INSN_JMP && in->op != INSN_RET)) continue;
+        for (int k = i + 1; k < u->insn_count && u->insns[k].op != INSN_LABEL && u->insns[k].op != INSN_SECTION; k++) {
+            if (!dead[k]) {
+                dead[k] = 1;
+                changed = 1;
+            }
+        }
+    }
+    return changed;
+}
+
+int opt_labels(CompileUnit* u, uint32_t* ids, char* dead) {
+    int* refs = arena_alloc(&u->arena, u->strs.count * sizeof(int));
+    int changed = 0;
+    memset(refs, 0, u->strs.count * sizeof(int));
+    for (int i = 0; i < u->insn_count; i++) {
+        if (!dead[i] && u->insns[i].op != INSN_LABEL) refs[ids[i]]++;
+    }
+    for (int i = 0; i < u->insn_count; i++) {
+        Insn* in = &u->insns[i];
+        if (!dead[i] && in->op == INSN_LABEL && in->sym[0] == '.' && !refs[ids[i]]) {
+            dead[i] = 1;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+int insn_total(CompileUnit* u) {
+    int n = 0;
+    for (int i = 0; i < u->insn_count; i++) {
+        if (u->insns[i].op != INSN_LABEL && u->insns[i].op != INSN_SECTION) n++;
+    }
+    return n;
+}
+
+void optimize(CompileUnit* u) {
+    int before = insn_total(u);
+    for (int pass = 0; pass < OPT_MAX_PASSES; pass++) {
+        int n = u->insn_count;
+        uint32_t* ids = arena_alloc(&u->arena, n * sizeof(uint32_t));
+        for (int i = 0; i < n; i++) {
+            const char* sym = u->insns[i].sym;
+            ids[i] = sym ? intern(&u->arena, &u->strs, sym, strlen(sym)) : 0;
+        }
+        int* label_at = arena_alloc(&u->arena, u->strs.count * sizeof(int));
+        uint32_t* func_live = arena_alloc(&u->arena, u->strs.count * sizeof(uint32_t));
+        int* target = arena_alloc(&u->arena, n * sizeof(int));
+        char* dead = arena_alloc(&u->arena, n);
+        uint32_t* live_out = arena_alloc(&u->arena, n * sizeof(uint32_t));
+        for (int i = 0; i < u->strs.count; i++) {
+            label_at[i] = -1;
+            func_live[i] = LIVE_ARGS;
+        }
+        memset(dead, 0, n);
+        opt_targets(u, target, ids, label_at);
+        int changed = opt_liveness(u, target, ids, dead, live_out, func_live);
+        changed |= opt_liveness(u, target, ids, dead, live_out, func_live);
+        changed |= opt_redundant(u, dead, live_out);
+        changed |= opt_jumps(u, target, ids, dead);
+        changed |= opt_labels(u, ids, dead);
+        int out = 0;
+        for (int i = 0; i < n; i++) {
+            if (!dead[i]) u->insns[out++] = u->insns[i];
+        }
+        u->insn_count = out;
+        if (!changed) break;
+    }
+    char msg[96];
+    snprintf(msg, sizeof(msg), "[Optimizing] %d -> %d instructions", before, insn_total(u));
+    unit_log(u, msg);
+}
+
+void reset_unit(CompileUnit* u) {
+    u->token_count = 0;
+    u->ast_count = 0;
+    out_free(&u->out);
+    u->insn_count = 0;
+    u->data_count = 0;
+    u->extern_count = 0;
+    u->global_count = 0;
+    arena_reset(&u->arena);
+    strtab_reset(&u->strs);
+}
+
+void free_unit(CompileUnit* u) {
+    reset_unit(u);
+    free(u->insns);
+    free(u->data);
+    free(u->externs);
+    free(u->globals);
+    free(u->tokens);
+    free(u->ast);
+    arena_free(&u->arena);
+    strtab_free(&u->strs);
+}
+
+int use_text_backend(CompileUnit* u) {
+    return emit_asm || !u->backend->elf;
+}
+
+void parse_file(CompileUnit* u, const char* input, size_t len) {
+    reset_unit(u);
+    double t = mono_time();
+    lexer(u, input, len);
+    unit_phase(u, PHASE_LEX, t);
+    t = mono_time();
+    parser(u);
+    unit_phase(u, PHASE_PARSE, t);
+}
+
+void generate_unit(CompileUnit* u) {
+    double t = mono_time();
+    codegen(u);
+    if (opt_level > 0) optimize(u);
+    if (use_text_backend(u)) emit_text(u);
+    unit_phase(u, PHASE_CODEGEN, t);
+}
+
+void adopt_unit(CompileUnit* u, CompileUnit* front) {
+    reset_unit(u);
+    if (u->ast_cap < front->ast_count) {
+        u->ast_cap = front->ast_count;
+        u->ast = xrealloc(u->ast, u->ast_cap * sizeof(ASTNode));
+    }
+    memcpy(u->ast, front->ast, front->ast_count * sizeof(ASTNode));
+    u->ast_count = front->ast_count;
+    for (int i = 1; i < front->strs.count; i++) {
+        intern(&u->arena, &u->strs, front->strs.entries[i].str, front->strs.entries[i].len);
+    }
+    u->src = front->src;
+}
+
+uint64_t unit_cache_key(CompileUnit* u, const char* input, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int platform = u->backend->platform;
+    h = hash_bytes(h, N0RYST_VERSION, sizeof(N0RYST_VERSION));
+    h = hash_bytes(h, &platform, sizeof(platform));
+    h = hash_bytes(h, &u->is_main, sizeof(u->is_main));
+    h = hash_bytes(h, &emit_asm, sizeof(emit_asm));
+    h = hash_bytes(h, &opt_level, sizeof(opt_level));
+    h = hash_bytes(h, u->config->exit_key, strlen(u->config->exit_key) + 1);
+    h = hash_bytes(h, &u->config->arena_size, sizeof(u->config->arena_size));
+    h = hash_bytes(h, &u->config->arena_hints, sizeof(u->config->arena_hints));
+    h = hash_bytes(h, u->config->level, strlen(u->config->level) + 1);
+    if (u->is_main && strcmp(u->config->level, "profile") == 0) h = hash_bytes(h, u->path, strlen(u->path) + 1);
+    return hash_bytes(h, input, len);
+}
+
+int copy_file(const char* from, const char* to) {
+    unlink(to);
+    if (link(from, to) == 0) return 1;
+    FILE* in = fopen(from, "rb");
+    if (!in) return 0;
+    FILE* out = fopen(to, "wb");
+    if (!out) {
+        fclose(in);
+        return 0;
+    }
+    char buf[4096];
+    size_t n;
+    int ok = 1;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) ok = 0;
+    }
+    fclose(in);
+    if (fclose(out) != 0) ok = 0;
+    return ok;
+}
+
+void cache_store(const char* obj_path, const char* cache_path) {
+    char* tmp_path = str_printf("%s.%ld.tmp", obj_path, (long)getpid());
+    if (!copy_file(obj_path, tmp_path) || rename(tmp_path, cache_path) != 0) unlink(tmp_path);
+    free(tmp_path);
+}
+
+void acquire_spawn() {
+    pthread_mutex_lock(&spawn_lock);
+    while (spawn_slots == 0) pthread_cond_wait(&spawn_cond, &spawn_lock);
+    spawn_slots--;
+    pthread_mutex_unlock(&spawn_lock);
+}
+
+void release_spawn() {
+    pthread_mutex_lock(&spawn_lock);
+    spawn_slots++;
+    pthread_cond_signal(&spawn_cond);
+    pthread_mutex_unlock(&spawn_lock);
+}
+
+pid_t spawn_tool(const char* const* args, int input) {
+    pid_t pid;
+    acquire_spawn();
+#ifdef _WIN32
+    int saved = input >= 0 ? dup(0) : -1;
+    if (input >= 0) dup2(input, 0);
+    pid = _spawnvp(_P_NOWAIT, args[0], args);
+    int err = pid < 0 ? errno : 0;
+    if (saved >= 0) {
+        dup2(saved, 0);
+        close(saved);
+    }
+#else
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (input >= 0) posix_spawn_file_actions_adddup2(&actions, input, STDIN_FILENO);
+    int err = posix_spawnp(&pid, args[0], &actions, NULL, (char* const*)args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+#endif
+    if (err) {
+        fprintf(stderr, "Error: Cannot run %s: %s\n", args[0], strerror(err));
+        release_spawn();
+        return -1;
+    }
+    return pid;
+}
+
+int wait_tool(pid_t pid, const char* name) {
+    int status = -1;
+#ifdef _WIN32
+    int ok = _cwait(&status, pid, 0) != -1 && status == 0;
+#else
+    pid_t r;
+    while ((r = waitpid(pid, &status, 0)) < 0 && errno == EINTR);
+    int ok = r == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (r == pid && WIFSIGNALED(status)) fprintf(stderr, "Error: %s killed by signal %d\n", name, WTERMSIG(status));
+#endif
+    release_spawn();
+    return ok;
+}
+
+int run_tool(const char* const* args, int input) {
+    pid_t pid = spawn_tool(args, input);
+    return pid > 0 && wait_tool(pid, args[0]);
+}
+
+void release_source(CompileUnit* u) {
+    if (!u->source.data) return;
+    free_source(&u->source);
+    u->source.data = NULL;
+}
+
+int fetch_cached(CompileUnit* u) {
+    char cache_path[64];
+    snprintf(cache_path, sizeof(cache_path), "%s/%016llx.o", CACHE_DIR, (unsigned long long)u->key);
+    if (!use_cache || !copy_file(cache_path, u->obj_path)) return 0;
+    u->cache_hit = 1;
+    unit_log(u, "[Cache] hit");
+    return 1;
+}
+
+void store_cached(CompileUnit* u) {
+    char cache_path[64];
+    snprintf(cache_path, sizeof(cache_path), "%s/%016llx.o", CACHE_DIR, (unsigned long long)u->key);
+    cache_store(u->obj_path, cache_path);
+}
+
+void write_object(CompileUnit* u) {
+    double t = mono_time();
+    if (!use_text_backend(u)) {
+        write_elf_object(u);
+        unit_phase(u, PHASE_ASSEMBLE, t);
+        if (use_cache && !u->status) store_cached(u);
+        return;
+    }
+#ifdef __linux__
+    int fd = syscall(SYS_memfd_create, u->asm_path, MFD_CLOEXEC);
+#else
+    int fd = open(u->asm_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+    int written = fd >= 0 && out_write(&u->out, fd);
+    out_free(&u->out);
+    if (!written) {
+        fprintf(stderr, "Error: Cannot write to %s\n", u->asm_path);
+        if (fd >= 0) close(fd);
+        u->status = 1;
+        return;
+    }
+    u->asm_fd = fd;
+    u->asm_pending = 1;
+    u->asm_start = t;
+}
+
+void start_assembler(CompileUnit* u) {
+    if (!u->asm_pending) return;
+    u->asm_pending = 0;
+#ifdef __linux__
+    const char* input = "/dev/stdin";
+    int in_fd = u->asm_fd;
+#else
+    const char* input = u->asm_path;
+    int in_fd = -1;
+#endif
+    const char* args[] = { "nasm", "-f", u->backend->nasm_format, input, "-o", u->obj_path, NULL };
+    u->tool_start = mono_time();
+    u->tool = spawn_tool(args, in_fd);
+    close(u->asm_fd);
+    if (u->tool < 0) {
+        u->tool = 0;
+        u->status = 1;
+    }
+}
+
+void finish_assembler(CompileUnit* u) {
+    if (!u->tool) return;
+    int ok = wait_tool(u->tool, "nasm");
+    u->tool = 0;
+    trace_span(&u->trace, "nasm", "process", u->path, u->worker, u->tool_start, mono_time());
+    if (!ok) {
+        fprintf(stderr, "Error: Assembling %s failed\n", u->path);
+        u->status = 1;
+        return;
+    }
+    unit_phase(u, PHASE_ASSEMBLE, u->asm_start);
+    if (use_cache && !stream_mode) store_cached(u);
+}
+
+void assemble_unit(CompileUnit* u) {
+    start_assembler(u);
+    finish_assembler(u);
+}
+
+void parse_front(CompileUnit* u) {
+    double t = mono_time();
+    Source* src = &u->source;
+    if (!read_source(u->path, src)) {
+        u->status = 1;
+        return;
+    }
+    unit_phase(u, PHASE_READ, t);
+    u->bytes = src->len;
+    int misses = 0;
+    for (CompileUnit* v = u->variant; v; v = v->variant) {
+        v->key = unit_cache_key(v, src->data, src->len);
+        misses += !fetch_cached(v);
+    }
+    if (misses) parse_file(u, src->data, src->len);
+}
+
+void build_variant(CompileUnit* u) {
+    if (u->cache_hit) return;
+    adopt_unit(u, u->front);
+    generate_unit(u);
+    write_object(u);
+}
+
+#define STREAM_CHUNK 65536
+
+typedef struct {
+    int fd;
+    int eof;
+    int out;
+    char* buf;
+    size_t cap;
+    Lexer lx;
+    ObjWriter obj;
+    Arena arena;
+    StrTab vars;
+    int serial;
+    const char* loop;
+    long long rate;
+    int paced;
+    int strings;
+    double spent[PHASE_COUNT];
+} Stream;
+
+void stream_fill(CompileUnit* u, Stream* s) {
+    double t = mono_time();
+    Lexer* lx = &s->lx;
+    if (lx->len == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : STREAM_CHUNK;
+        s->buf = xrealloc(s->buf, s->cap);
+        lx->input = s->buf;
+    }
+    ssize_t n;
+    while ((n = read(s->fd, s->buf + lx->len, s->cap - lx->len)) < 0 && errno == EINTR);
+    if (n < 0) {
+        fprintf(stderr, "Error: Cannot read file %s\n", u->path);
+        fail();
+    }
+    lx->len += n;
+    u->bytes += n;
+    s->eof = n == 0;
+    s->spent[PHASE_READ] += mono_time() - t;
+}
+
+void stream_token(CompileUnit* u, Stream* s, Token* tok) {
+    Lexer* lx = &s->lx;
+    for (;;) {
+        if (lx->pos < lx->len && char_class[(unsigned char)lx->input[lx->pos]] == CC_SPACE) lx->pos = lex_span(lx, lx->pos + 1, CC_SPACE);
+        if (!s->eof && lx->len - lx->pos < 3) {
+            stream_fill(u, s);
+            continue;
+        }
+        size_t pos = lx->pos;
+        lex_next(lx, tok);
+        if (s->eof || lx->pos < lx->len) return;
+        lx->pos = pos;
+        stream_fill(u, s);
+    }
+}
+
+int stream_block(CompileUnit* u, Stream* s) {
+    double t = mono_time();
+    double read = s->spent[PHASE_READ];
+    Lexer* lx = &s->lx;
+    if (lx->pos) {
+        memmove(s->buf, s->buf + lx->pos, lx->len - lx->pos);
+        lx->base += lx->pos;
+        lx->len -= lx->pos;
+        lx->pos = 0;
+    }
+    u->token_count = 0;
+    Token* tok;
+    do {
+        tok = push_token(u);
+        stream_token(u, s, tok);
+    } while (tok->type != TOKEN_EOF && tok->type != TOKEN_OP_BLOCK_END);
+    if (tok->type != TOKEN_EOF) *push_token(u) = (Token){ TOKEN_EOF, 0, lx->pos };
+    u->src = s->buf;
+    s->spent[PHASE_LEX] += mono_time() - t - (s->spent[PHASE_READ] - read);
+    return u->token_count > 1;
+}
+
+void stream_begin(CompileUnit* u) {
+    const Backend* b = u->backend;
+    int frame = (b->shadow_space + 15) & ~15;
+    if (u->is_main) asm_global(u, b->entry);
+    asm_label(u, u->is_main ? b->entry : "module_init");
+    asm_reg(u, INSN_PUSH, REG_RBP);
+    asm_reg_reg(u, INSN_MOV_RR, REG_RBP, REG_RSP);
+    if (frame) asm_reg_imm(u, INSN_SUB_RI, REG_RSP, frame);
+    if (u->is_main && b->emit_tty) asm_sym(u, INSN_CALL, "tty_init");
+    asm_sym(u, INSN_CALL, "stream_setup");
+}
+
+void stream_lower(CompileUnit* u, Stream* s) {
+    const Backend* b = u->backend;
+    const char** pool = arena_alloc(&u->arena, u->strs.count * sizeof(char*));
+    const char** strings = arena_alloc(&u->arena, u->strs.count * sizeof(char*));
+    memset(pool, 0, u->strs.count * sizeof(char*));
+    memset(strings, 0, u->strs.count * sizeof(char*));
+    for (int i = 0; i < u->ast_count; i++) {
+        ASTNode* n = &u->ast[i];
+        if (n->type == AST_VARDECL || n->type == AST_VARCOPY || n->type == AST_VARSTR) {
+            StrEntry* name = &u->strs.entries[n->value];
+            StrEntry* value = &u->strs.entries[n->value2];
+            uint32_t src = n->type == AST_VARCOPY ? strtab_find(&s->vars, value->str, value->len) : 0;
+            char* end;
+            long long imm = strtoll(value->str, &end, 10);
+            if (n->type == AST_VARSTR) {
+                asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, pool_literal(u, strings, n->value2, "lit", '\0', s->serial));
+                asm_reg_imm(u, INSN_MOV_RI, REG_RDX, value->len);
+                asm_sym(u, INSN_CALL, "arena_str");
+                s->strings = 1;
+            } else if (src) {
+                asm_reg_sym(u, INSN_LEA_RSYM, REG_RCX, unit_name(u, "var", src));
+                asm_load_mem(u, REG_RAX, REG_RCX, 0);
+            } else if (*end == '\0') {
+                asm_reg_imm(u, INSN_MOV_RI, REG_RAX, imm);
+            } else {
+                asm_reg_sym(u, INSN_MOV_RSYM, REG_RAX, value->str);
+            }
+            int count = s->vars.count;
+            uint32_t id = intern(&s->arena, &s->vars, name->str, name->len);
+            const char* home = unit_name(u, "var", id);
+            if ((int)id >= count) asm_data(u, ".bss", home, NULL, 8);
+            asm_reg_sym(u, INSN_LEA_RSYM, REG_RCX, home);
+            asm_store_mem(u, REG_RCX, 0, REG_RAX);
+        } else if (n->type == AST_PRINT) {
+            asm_reg_sym(u, INSN_LEA_RSYM, REG_RSI, pool_literal(u, pool, n->value, "str", '\n', s->serial));
+            asm_reg_imm(u, INSN_MOV_RI, REG_RDX, u->strs.entries[n->value].len + 1);
+            asm_sym(u, INSN_CALL, "print");
+        } else if (n->type == AST_KBCHK) {
+            emit_kbchk(u, unit_name(u, ".no_input", s->serial + i), "stream_exit");
+        } else if (n->type == AST_LOOP) {
+            s->rate = n->value ? strtoll(ast_str(u, n->value), NULL, 10) : 0;
+            s->paced |= s->rate != 0;
+            if (s->rate && b->tick_absolute) asm_sym(u, INSN_CALL, "tick_start");
+            s->loop = unit_name(u, ".loop", s->serial + i);
+            asm_label(u, s->loop);
+        } else if (n->type == AST_LOOP_END) {
+            if (s->rate) b->emit_loop_wait(u, 1000000000 / s->rate);
+            asm_sym(u, INSN_JMP, s->loop);
+        }
+    }
+    s->serial += u->ast_count > u->strs.count ? u->ast_count : u->strs.count;
+}
+
+void stream_end(CompileUnit* u, Stream* s) {
+    const Backend* b = u->backend;
+    asm_label(u, "stream_exit");
+    asm_sym(u, INSN_CALL, "flush");
+    if (u->is_main && b->emit_tty) asm_sym(u, INSN_CALL, "tty_restore");
+    asm_reg_reg(u, INSN_MOV_RR, REG_RSP, REG_RBP);
+    asm_reg(u, INSN_POP, REG_RBP);
+    if (u->is_main) {
+        b->emit_exit(u);
+    } else {
+        asm_op(u, INSN_RET);
+    }
+    asm_label(u, "stream_setup");
+    if (s->strings) asm_sym(u, INSN_JMP, "arena_init");
+    else asm_op(u, INSN_RET);
+    emit_runtime_data(u, s->paced, s->strings);
+    emit_runtime(u, s->paced, s->strings);
+}
+
+void stream_flush(CompileUnit* u, Stream* s) {
+    if (s->out < 0) {
+        obj_encode(u, &s->obj);
+    } else {
+        emit_text(u);
+        if (!out_write(&u->out, s->out)) {
+            fprintf(stderr, "Error: Cannot write to %s\n", u->asm_path);
+            fail();
+        }
+        out_free(&u->out);
+        u->extern_count = 0;
+        u->global_count = 0;
+    }
+    u->insn_count = 0;
+    u->data_count = 0;
+    arena_reset(&u->arena);
+    strtab_reset(&u->strs);
+}
+
+void stream_close(Stream* s) {
+    if (s->fd >= 0) close(s->fd);
+    if (s->out >= 0) close(s->out);
+    free(s->buf);
+    obj_free(&s->obj);
+    arena_free(&s->arena);
+    strtab_free(&s->vars);
+}
+
+void stream_unit(CompileUnit* u) {
+    if (strcmp(u->config->level, "profile") == 0) {
+        fprintf(stderr, "Error: --stream does not support level: profile in %s\n", u->path);
+        u->status = 1;
+        return;
+    }
+    Stream s = { .fd = -1, .out = -1, .obj = { .sec_count = 1 } };
+    double start = mono_time();
+    reset_unit(u);
+    u->key = 0;
+    u->bytes = 0;
+    s.fd = strcmp(u->path, "-") == 0 ? dup(STDIN_FILENO) : open(u->path, O_RDONLY);
+    if (s.fd < 0) {
+        fprintf(stderr, "Error: Cannot open file %s\n", u->path);
+        u->status = 1;
+        return;
+    }
+    if (use_text_backend(u)) {
+#ifdef __linux__
+        s.out = syscall(SYS_memfd_create, u->asm_path, MFD_CLOEXEC);
+#else
+        s.out = open(u->asm_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+        if (s.out < 0) {
+            fprintf(stderr, "Error: Cannot write to %s\n", u->asm_path);
+            stream_close(&s);
+            u->status = 1;
+            return;
+        }
+    }
+    jmp_buf jump;
+    jmp_buf* outer = fail_jump;
+    if (setjmp(jump) != 0) {
+        fail_jump = outer;
+        stream_close(&s);
+        fail();
+    }
+    fail_jump = &jump;
+    lexer_init(&s.lx, NULL, 0);
+    strtab_reset(&s.vars);
+    stream_begin(u);
+    stream_flush(u, &s);
+    while (stream_block(u, &s)) {
+        double t = mono_time();
+        u->ast_count = 0;
+        parser(u);
+        s.spent[PHASE_PARSE] += mono_time() - t;
+        t = mono_time();
+        stream_lower(u, &s);
+        stream_flush(u, &s);
+        s.spent[PHASE_CODEGEN] += mono_time() - t;
+    }
+    double t = mono_time();
+    stream_end(u, &s);
+    stream_flush(u, &s);
+    s.spent[PHASE_CODEGEN] += mono_time() - t;
+    for (int p = PHASE_READ; p <= PHASE_CODEGEN; p++) {
+        char msg[64];
+        u->phase_time[p] += s.spent[p];
+        snprintf(msg, sizeof(msg), "%s %.3f ms", phase_logs[p], s.spent[p] * 1e3);
+        unit_log(u, msg);
+    }
+    t = mono_time();
+    trace_span(&u->trace, "stream", "phase", u->path, u->worker, start, t);
+    if (s.out < 0) {
+        obj_finish(u, &s.obj);
+        unit_phase(u, PHASE_ASSEMBLE, t);
+    } else {
+        u->asm_fd = s.out;
+        u->asm_pending = 1;
+        u->asm_start = t;
+        s.out = -1;
+    }
+    fail_jump = outer;
+    stream_close(&s);
+}
+
+void build_unit(CompileUnit* u) {
+    if (stream_mode && !u->front && !u->variant) {
+        stream_unit(u);
+        return;
+    }
+    if (u->front) {
+        build_variant(u);
+        return;
+    }
+    if (u->variant) {
+        parse_front(u);
+        return;
+    }
+    double t = mono_time();
+    Source* src = &u->source;
+    if (!read_source(u->path, src)) {
+        u->status = 1;
+        return;
+    }
+    unit_phase(u, PHASE_READ, t);
+    u->bytes = src->len;
+    uint64_t key = unit_cache_key(u, src->data, src->len);
+    if (watch_mode && key == u->key) {
+        u->unchanged = 1;
+        release_source(u);
+        return;
+    }
+    u->key = key;
+    if (fetch_cached(u)) {
+        release_source(u);
+        return;
+    }
+    parse_file(u, src->data, src->len);
+    generate_unit(u);
+    release_source(u);
+    write_object(u);
+}
+
+void run_unit(CompileUnit* u) {
+    jmp_buf jump;
+    jmp_buf* outer = fail_jump;
+    if (!recover_errors) {
+        build_unit(u);
+    } else if (setjmp(jump) == 0) {
+        fail_jump = &jump;
+        build_unit(u);
+    } else {
+        release_source(u);
+        u->status = 1;
+    }
+    fail_jump = outer;
+    if (u->status) u->key = 0;
+}
+
+#define LINK_BASE 0x400000
+#define LINK_PAGE 0x1000
+#define LINK_INTERP "/lib64/ld-linux-x86-64.so.2"
+#define LINK_LIBC "libc.so.6"
+#define R_X86_64_GLOB_DAT 6
+#define R_X86_64_32 10
+#define R_X86_64_32S 11
+#define SHN_ABS 0xFFF1
+
+typedef struct {
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t addralign;
+    uint64_t entsize;
+} ElfShdr;
+
+typedef struct {
+    uint32_t name;
+    unsigned char info;
+    unsigned char other;
+    uint16_t shndx;
+    uint64_t value;
+    uint64_t size;
+} ElfSym;
+
+typedef struct {
+    const char* path;
+    unsigned char* image;
+    size_t size;
+    ElfShdr* shdrs;
+    int shnum;
+    ElfSym* syms;
+    int sym_count;
+    const char* strtab;
+    int* sec_map;
+} LinkObject;
+
+typedef struct {
+    LinkObject* obj;
+    const char* name;
+    const unsigned char* data;
+    uint64_t size;
+    uint64_t align;
+    int exec;
+    int write;
+    int nobits;
+    int runtime;
+    ElfRela* relas;
+    int rela_count;
+    int fold_to;
+    int live;
+    uint64_t addr;
+    uint64_t offset;
+} LinkSection;
+
+typedef struct {
+    const char* name;
+    int section;
+    uint64_t value;
+} LinkGlobal;
+
+typedef struct {
+    LinkObject* objs;
+    int obj_count;
+    LinkSection* secs;
+    int sec_count;
+    LinkGlobal* globals;
+    int global_count;
+    const char** imports;
+    int import_count;
+} Linker;
+
+typedef struct {
+    int section;
+    int import;
+    uint64_t value;
+} LinkTarget;
+
+void link_error(const char* msg, const char* detail) {
+    fprintf(stderr, "Error: %s%s\n", msg, detail);
+    fail();
+}
+
+uint64_t align_up(uint64_t v, uint64_t align) {
+    return align > 1 ? (v + align - 1) & ~(align - 1) : v;
+}
+
+LinkGlobal* link_find_global(Linker* l, const char* name) {
+    for (int i = 0; i < l->global_count; i++) {
+        if (strcmp(l->globals[i].name, name) == 0) return &l->globals[i];
+    }
+    return NULL;
+}
+
+void link_load_object(Linker* l, const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) link_error("Cannot open object ", path);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char* image = malloc(size > 0 ? size : 1);
+    if (!image || fread(image, 1, size, f) != (size_t)size) link_error("Cannot read object ", path);
+    fclose(f);
+    if (size < 64 || memcmp(image, "\x7F" "ELF\x02\x01", 6) != 0 || image[16] != 1 || image[18] != 62) {
+        link_error("Not an x86-64 ELF64 relocatable object: ", path);
+    }
+
+    LinkObject* obj = &l->objs[l->obj_count++];
+    obj->path = path;
+    obj->image = image;
+    obj->size = size;
+    uint64_t shoff;
+    uint16_t shnum;
+    memcpy(&shoff, image + 40, 8);
+    memcpy(&shnum, image + 60, 2);
+    if (shoff + (uint64_t)shnum * sizeof(ElfShdr) > (uint64_t)size) link_error("Truncated section table in ", path);
+    obj->shdrs = (ElfShdr*)(image + shoff);
+    obj->shnum = shnum;
+    obj->sec_map = malloc(shnum * sizeof(int));
+    if (!obj->sec_map) link_error("Out of memory", "");
+
+    for (int i = 0; i < shnum; i++) {
+        ElfShdr* sh = &obj->shdrs[i];
+        obj->sec_map[i] = -1;
+        if (sh->type == 2) {
+            obj->syms = (ElfSym*)(image + sh->offset);
+            obj->sym_count = sh->size / sizeof(ElfSym);
+            obj->strtab = (const char*)(image + obj->shdrs[sh->link].offset);
+        }
+        if (!(sh->flags & 2) || (sh->type != 1 && sh->type != 8)) continue;
+        l->secs = xrealloc(l->secs, (l->sec_count + 1) * sizeof(LinkSection));
+        const char* shstr = (const char*)(image + obj->shdrs[((uint16_t*)(image + 62))[0]].offset);
+        LinkSection* sec = &l->secs[l->sec_count];
+        memset(sec, 0, sizeof(*sec));
+        sec->obj = obj;
+        sec->name = shstr + sh->name;
+        sec->data = sh->type == 8 ? NULL : image + sh->offset;
+        sec->size = sh->size;
+        sec->align = sh->addralign ? sh->addralign : 1;
+        sec->exec = (sh->flags & 4) != 0;
+        sec->write = (sh->flags & 1) != 0;
+        sec->nobits = sh->type == 8;
+        sec->runtime = strstr(sec->name, RUNTIME_SECTION) != NULL;
+        sec->fold_to = l->sec_count;
+        obj->sec_map[i] = l->sec_count++;
+    }
+    for (int i = 0; i < shnum; i++) {
+        ElfShdr* sh = &obj->shdrs[i];
+        if (sh->type != 4 || sh->info >= (uint32_t)shnum || obj->sec_map[sh->info] < 0) continue;
+        LinkSection* sec = &l->secs[obj->sec_map[sh->info]];
+        sec->relas = (ElfRela*)(image + sh->offset);
+        sec->rela_count = sh->size / sizeof(ElfRela);
+    }
+    for (int i = 1; i < obj->sym_count; i++) {
+        ElfSym* sym = &obj->syms[i];
+        const char* name = obj->strtab + sym->name;
+        if ((sym->info >> 4) == 0 || sym->shndx == 0) continue;
+        if (link_find_global(l, name)) link_error("Duplicate symbol ", name);
+        l->globals = xrealloc(l->globals, (l->global_count + 1) * sizeof(LinkGlobal));
+        l->globals[l->global_count++] = (LinkGlobal){
+            .name = name, .section = sym->shndx == SHN_ABS ? -1 : obj->sec_map[sym->shndx], .value = sym->value
+        };
+    }
+}
+
+LinkTarget link_target(Linker* l, LinkObject* obj, uint32_t index) {
+    if (index >= (uint32_t)obj->sym_count) link_error("Bad symbol index in ", obj->path);
+    ElfSym* sym = &obj->syms[index];
+    const char* name = obj->strtab + sym->name;
+    if (sym->shndx == SHN_ABS) return (LinkTarget){ .section = -1, .import = -1, .value = sym->value };
+    if (sym->shndx != 0) {
+        if (sym->shndx >= obj->shnum || obj->sec_map[sym->shndx] < 0) link_error("Relocation against unsupported section in ", obj->path);
+        return (LinkTarget){ .section = obj->sec_map[sym->shndx], .import = -1, .value = sym->value };
+    }
+    LinkGlobal* g = link_find_global(l, name);
+    if (g) return (LinkTarget){ .section = g->section, .import = -1, .value = g->value };
+    for (int i = 0; i < l->import_count; i++) {
+        if (strcmp(l->imports[i], name) == 0) return (LinkTarget){ .section = -1, .import = i };
+    }
+    l->imports = xrealloc(l->imports, (l->import_count + 1) * sizeof(char*));
+    l->imports[l->import_count] = name;
+    return (LinkTarget){ .section = -1, .import = l->import_count++ };
+}
+
+int link_targets_equal(Linker* l, LinkTarget a, LinkTarget b) {
+    if (a.import >= 0 || b.import >= 0) {
+        return a.import >= 0 && b.import >= 0 && strcmp(l->imports[a.import], l->imports[b.import]) == 0;
+    }
+    if (a.value != b.value) return 0;
+    if (a.section < 0 || b.section < 0) return a.section == b.section;
+    LinkSection* sa = &l->secs[a.section];
+    LinkSection* sb = &l->secs[b.section];
+    if (sa->runtime && sb->runtime) return strcmp(sa->name, sb->name) == 0;
+    return a.section == b.section;
+}
+
+int link_sections_equal(Linker* l, LinkSection* a, LinkSection* b) {
+    if (a->size != b->size || a->nobits != b->nobits || a->rela_count != b->rela_count) return 0;
+    if (!a->nobits && memcmp(a->data, b->data, a->size) != 0) return 0;
+    for (int i = 0; i < a->rela_count; i++) {
+        ElfRela* ra = &a->relas[i];
+        ElfRela* rb = &b->relas[i];
+        if (ra->offset != rb->offset || ra->addend != rb->addend || (ra->info & 0xFFFFFFFF) != (rb->info & 0xFFFFFFFF)) return 0;
+        if (!link_targets_equal(l, link_target(l, a->obj, ra->info >> 32), link_target(l, b->obj, rb->info >> 32))) return 0;
+    }
+    return 1;
+}
+
+int link_fold_sections(Linker* l) {
+    int* foldable = calloc(l->sec_count, sizeof(int));
+    if (!foldable) link_error("Out of memory", "");
+    for (int i = 0; i < l->sec_count; i++) {
+        LinkSection* sec = &l->secs[i];
+        if (!sec->runtime) continue;
+        int rep = i;
+        for (int j = 0; j < i; j++) {
+            if (l->secs[j].runtime && strcmp(l->secs[j].name, sec->name) == 0) {
+                rep = j;
+                break;
+            }
+        }
+        sec->fold_to = rep;
+        foldable[i] = 1;
+    }
+    for (int i = 0; i < l->sec_count; i++) {
+        LinkSection* sec = &l->secs[i];
+        if (sec->runtime && sec->fold_to != i && !link_sections_equal(l, &l->secs[sec->fold_to], sec)) {
+            foldable[sec->fold_to] = 0;
+        }
+    }
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int i = 0; i < l->sec_count; i++) {
+            LinkSection* sec = &l->secs[i];
+            if (!sec->runtime || !foldable[sec->fold_to]) continue;
+            for (int r = 0; r < sec->rela_count; r++) {
+                LinkTarget t = link_target(l, sec->obj, sec->relas[r].info >> 32);
+                if (t.section >= 0 && l->secs[t.section].runtime && !foldable[l->secs[t.section].fold_to]) {
+                    foldable[sec->fold_to] = 0;
+                    changed = 1;
+                    break;
+                }
+            }
+        }
+    }
+    int folded = 0;
+    for (int i = 0; i < l->sec_count; i++) {
+        LinkSection* sec = &l->secs[i];
+        if (!foldable[sec->fold_to]) sec->fold_to = i;
+        if (sec->fold_to != i) folded++;
+    }
+    free(foldable);
+    return folded;
+}
+
+void link_mark(Linker* l, int index) {
+    LinkSection* sec = &l->secs[l->secs[index].fold_to];
+    if (sec->live) return;
+    sec->live = 1;
+    for (int r = 0; r < sec->rela_count; r++) {
+        LinkTarget t = link_target(l, sec->obj, sec->relas[r].info >> 32);
+        if (t.section >= 0) link_mark(l, t.section);
+    }
+}
+
+uint64_t link_target_addr(Linker* l, LinkTarget t, uint64_t plt_addr) {
+    if (t.import >= 0) return plt_addr + 8 * t.import;
+    if (t.section < 0) return t.value;
+    return l->secs[l->secs[t.section].fold_to].addr + t.value;
+}
+
+void elf_phdr(ByteBuf* b, uint32_t type, uint32_t flags, uint64_t offset, uint64_t addr, uint64_t filesz, uint64_t memsz, uint64_t align) {
+    buf_u32(b, type);
+    buf_u32(b, flags);
+    buf_u64(b, offset);
+    buf_u64(b, addr);
+    buf_u64(b, addr);
+    buf_u64(b, filesz);
+    buf_u64(b, memsz);
+    buf_u64(b, align);
+}
+
+void buf_fill(ByteBuf* b, size_t offset) {
+    while (b->len < offset) buf_byte(b, 0);
+}
+
+void link_executable(const char* out_path, const char** objects, int object_count, char* report, size_t report_len) {
+    Linker l = {0};
+    l.objs = calloc(object_count, sizeof(LinkObject));
+    if (!l.objs) link_error("Out of memory", "");
+    for (int i = 0; i < object_count; i++) link_load_object(&l, objects[i]);
+    LinkGlobal* entry = link_find_global(&l, "main");
+    if (!entry || entry->section < 0) link_error("Entry symbol 'main' is not defined", "");
+
+    int folded = link_fold_sections(&l);
+    link_mark(&l, entry->section);
+    for (int i = 0; i < l.sec_count; i++) {
+        if (!l.secs[i].runtime) link_mark(&l, i);
+    }
+    int dropped = 0;
+    for (int i = 0; i < l.sec_count; i++) {
+        if (l.secs[i].fold_to == i && !l.secs[i].live) dropped++;
+    }
+    for (int i = 0; i < l.sec_count; i++) {
+        LinkSection* sec = &l.secs[i];
+        if (!sec->live || sec->fold_to != i) continue;
+        for (int r = 0; r < sec->rela_count; r++) link_target(&l, sec->obj, sec->relas[r].info >> 32);
+    }
+
+    int dynamic = l.import_count > 0;
+    int phnum = dynamic ? 6 : 3;
+    uint64_t off = 64 + phnum * 56;
+    uint64_t interp_off = 0, dynstr_off = 0, dynsym_off = 0, hash_off = 0, reladyn_off = 0;
+    ByteBuf dynstr = {0};
+    if (dynamic) {
+        interp_off = off;
+        off += sizeof(LINK_INTERP);
+        buf_byte(&dynstr, 0);
+        buf_put(&dynstr, LINK_LIBC, sizeof(LINK_LIBC));
+        dynstr_off = off;
+        for (int i = 0; i < l.import_count; i++) {
+            buf_put(&dynstr, l.imports[i], strlen(l.imports[i]) + 1);
+        }
+        off += dynstr.len;
+        dynsym_off = off = align_up(off, 8);
+        off += 24 * (l.import_count + 1);
+        hash_off = off;
+        off += 4 * (4 + l.import_count);
+        reladyn_off = off = align_up(off, 8);
+        off += 24 * l.import_count;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < l.sec_count; i++) {
+            LinkSection* sec = &l.secs[i];
+            if (!sec->live || sec->fold_to != i || sec->write || sec->nobits || sec->exec != !pass) continue;
+            sec->offset = off = align_up(off, sec->align);
+            sec->addr = LINK_BASE + off;
+            off += sec->size;
+        }
+    }
+    uint64_t plt_off = off = align_up(off, 16);
+    off += 8 * l.import_count;
+    uint64_t rx_end = off;
+
+    uint64_t rw_off = off = align_up(off, LINK_PAGE);
+    for (int i = 0; i < l.sec_count; i++) {
+        LinkSection* sec = &l.secs[i];
+        if (!sec->live || sec->fold_to != i || !sec->write || sec->nobits) continue;
+        sec->offset = off = align_up(off, sec->align);
+        sec->addr = LINK_BASE + off;
+        off += sec->size;
+    }
+    uint64_t got_off = off = align_up(off, 8);
+    off += 8 * l.import_count;
+    uint64_t dynamic_off = off;
+    if (dynamic) off += 16 * 11;
+    uint64_t rw_file_end = off;
+    uint64_t mem_end = off;
+    for (int i = 0; i < l.sec_count; i++) {
+        LinkSection* sec = &l.secs[i];
+        if (!sec->live || sec->fold_to != i || !sec->nobits) continue;
+        sec->offset = mem_end = align_up(mem_end, sec->align);
+        sec->addr = LINK_BASE + mem_end;
+        mem_end += sec->size;
+    }
+    for (int i = 0; i < l.sec_count; i++) {
+        LinkSection* sec = &l.secs[i];
+        if (sec->fold_to != i) sec->addr = l.secs[sec->fold_to].addr;
+    }
+
+    ByteBuf img = {0};
+    buf_fill(&img, 64 + phnum * 56);
+    if (dynamic) {
+        buf_put(&img, LINK_INTERP, sizeof(LINK_INTERP));
+        buf_put(&img, dynstr.data, dynstr.len);
+        buf_fill(&img, dynsym_off);
+        ElfSym null_sym = {0};
+        buf_put(&img, &null_sym, sizeof(null_sym));
+        uint32_t name = 1 + sizeof(LINK_LIBC);
+        for (int i = 0; i < l.import_count; i++) {
+            ElfSym sym = { .name = name, .info = (1 << 4) | 2 };
+            buf_put(&img, &sym, sizeof(sym));
+            name += strlen(l.imports[i]) + 1;
+        }
+        buf_u32(&img, 1);
+        buf_u32(&img, l.import_count + 1);
+        buf_u32(&img, l.import_count);
+        for (int i = 0; i <= l.import_count; i++) buf_u32(&img, i ? i - 1 : 0);
+        buf_fill(&img, reladyn_off);
+        for (int i = 0; i < l.import_count; i++) {
+            ElfRela r = { LINK_BASE + got_off + 8 * i, ((uint64_t)(i + 1) << 32) | R_X86_64_GLOB_DAT, 0 };
+            buf_put(&img, &r, sizeof(r));
+        }
+    }
+    buf_fill(&img, rw_file_end);
+    for (int i = 0; i < l.sec_count; i++) {
+        LinkSection* sec = &l.secs[i];
+        if (!sec->live || sec->fold_to != i || sec->nobits) continue;
+        memcpy(img.data + sec->offset, sec->data, sec->size);
+    }
+    for (int i = 0; i < l.import_count; i++) {
+        unsigned char* stub = img.data + plt_off + 8 * i;
+        int32_t rel = (int32_t)((got_off + 8 * i) - (plt_off + 8 * i + 6));
+        stub[0] = 0xFF;
+        stub[1] = 0x25;
+        memcpy(stub + 2, &rel, 4);
+        stub[6] = 0xCC;
+        stub[7] = 0xCC;
+    }
+    if (dynamic) {
+        uint64_t dyn[][2] = {
+            { 1, 1 }, { 4, LINK_BASE + hash_off }, { 5, LINK_BASE + dynstr_off }, { 6, LINK_BASE + dynsym_off },
+            { 10, dynstr.len }, { 11, 24 }, { 7, LINK_BASE + reladyn_off }, { 8, 24 * l.import_count },
+            { 9, 24 }, { 21, 0 }, { 0, 0 }
+        };
+        memcpy(img.data + dynamic_off, dyn, sizeof(dyn));
+    }
+
+    uint64_t plt_addr = LINK_BASE + plt_off;
+    for (int i = 0; i < l.sec_count; i++) {
+        LinkSection* sec = &l.secs[i];
+        if (!sec->live || sec->fold_to != i || sec->nobits) continue;
+        for (int r = 0; r < sec->rela_count; r++) {
+            ElfRela* rela = &sec->relas[r];
+            uint32_t type = rela->info & 0xFFFFFFFF;
+            uint64_t s = link_target_addr(&l, link_target(&l, sec->obj, rela->info >> 32), plt_addr);
+            uint64_t p = sec->addr + rela->offset;
+            unsigned char* where = img.data + sec->offset + rela->offset;
+            int64_t value = (int64_t)(s + rela->addend);
+            if (type == R_X86_64_64) {
+                memcpy(where, &value, 8);
+                continue;
+            }
+            if (type == R_X86_64_PC32 || type == R_X86_64_PLT32) value -= (int64_t)p;
+            else if (type != R_X86_64_32 && type != R_X86_64_32S) link_error("Unsupported relocation type in ", sec->obj->path);
+            if (type == R_X86_64_32 ? (uint64_t)value > 0xFFFFFFFFULL : value < INT32_MIN || value > INT32_MAX) {
+                link_error("Relocation out of range in ", sec->obj->path);
+            }
+            uint32_t v32 = (uint32_t)value;
+            memcpy(where, &v32, 4);
+        }
+    }
+
+    ByteBuf hdr = {0};
+    static const unsigned char ident[16] = { 0x7F, 'E', 'L', 'F', 2, 1, 1, 0 };
+    buf_put(&hdr, ident, 16);
+    buf_u16(&hdr, 2);
+    buf_u16(&hdr, 62);
+    buf_u32(&hdr, 1);
+    buf_u64(&hdr, l.secs[entry->section].addr + entry->value);
+    buf_u64(&hdr, 64);
+    buf_u64(&hdr, 0);
+    buf_u32(&hdr, 0);
+    buf_u16(&hdr, 64);
+    buf_u16(&hdr, 56);
+    buf_u16(&hdr, phnum);
+    buf_u16(&hdr, 64);
+    buf_u16(&hdr, 0);
+    buf_u16(&hdr, 0);
+    if (dynamic) {
+        elf_phdr(&hdr, 6, 4, 64, LINK_BASE + 64, phnum * 56, phnum * 56, 8);
+        elf_phdr(&hdr, 3, 4, interp_off, LINK_BASE + interp_off, sizeof(LINK_INTERP), sizeof(LINK_INTERP), 1);
+    }
+    elf_phdr(&hdr, 1, 5, 0, LINK_BASE, rx_end, rx_end, LINK_PAGE);
+    elf_phdr(&hdr, 1, 6, rw_off, LINK_BASE + rw_off, rw_file_end - rw_off, mem_end - rw_off, LINK_PAGE);
+    if (dynamic) elf_phdr(&hdr, 2, 6, dynamic_off, LINK_BASE + dynamic_off, 16 * 11, 16 * 11, 8);
+    elf_phdr(&hdr, 0x6474e551, 6, 0, 0, 0, 0, 16);
+    memcpy(img.data, hdr.data, hdr.len);
+
+    FILE* f = fopen(out_path, "wb");
+    if (!f || fwrite(img.data, 1, img.len, f) != img.len) link_error("Cannot write to ", out_path);
+    fclose(f);
+    chmod(out_path, 0755);
+
+    snprintf(report, report_len, "Linked %d objects: %d sections folded, %d dropped, %zu bytes\n",
+             object_count, folded, dropped, img.len);
+
+    for (int i = 0; i < l.obj_count; i++) {
+        free(l.objs[i].image);
+        free(l.objs[i].sec_map);
+    }
+    free(l.objs);
+    free(l.secs);
+    free(l.globals);
+    free(l.imports);
+    free(dynstr.data);
+    free(img.data);
+    free(hdr.data);
+}
+
+int arg_count(const char* const* args) {
+    int n = 0;
+    while (args[n]) n++;
+    return n;
+}
+
+const char** link_args(const Backend* b, const char* out, const char** objects, int object_count) {
+    const char** args = malloc((arg_count(b->ld_args) + arg_count(b->ld_main_libs) + arg_count(b->ld_libs) + object_count + 2) * sizeof(char*));
+    if (!args) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    int n = 0;
+    for (int i = 0; b->ld_args[i]; i++) args[n++] = b->ld_args[i];
+    args[n++] = out;
+    for (int i = 0; i < object_count; i++) {
+        args[n++] = objects[i];
+        for (int j = 0; i == 0 && b->ld_main_libs[j]; j++) args[n++] = b->ld_main_libs[j];
+    }
+    for (int i = 0; b->ld_libs[i]; i++) args[n++] = b->ld_libs[i];
+    args[n] = NULL;
+    return args;
+}
+
+void json_str(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+void write_trace_spans(FILE* f, Trace* t, int* first) {
+    for (int i = 0; i < t->count; i++) {
+        TraceSpan* sp = &t->spans[i];
+        fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+            *first ? "" : ",\n", sp->name, sp->cat, sp->tid, (sp->start - build_start) * 1e6, (sp->end - sp->start) * 1e6);
+        if (sp->unit) {
+            fprintf(f, ",\"args\":{\"unit\":");
+            json_str(f, sp->unit);
+            fputc('}', f);
+        }
+        fputc('}', f);
+        *first = 0;
+    }
+}
+
+void write_trace(Project* projects, int project_count) {
+    FILE* f = fopen(trace_path, "w");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot write to %s\n", trace_path);
+        return;
+    }
+    int first = 1;
+    fprintf(f, "{\"traceEvents\":[\n");
+    write_trace_spans(f, &main_trace, &first);
+    for (int i = 0; i < project_count; i++) {
+        write_trace_spans(f, &projects[i].trace, &first);
+        for (int j = 0; j < projects[i].unit_count; j++) {
+            write_trace_spans(f, &projects[i].units[j].trace, &first);
+        }
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    if (fclose(f) != 0) fprintf(stderr, "Error: Cannot write to %s\n", trace_path);
+}
+
+void print_time_report(Project* projects, int project_count, double total) {
+    double phase_total[PHASE_COUNT] = {0};
+    int unit_count = 0;
+    for (int i = 0; i < project_count; i++) {
+        Project* p = &projects[i];
+        for (int j = 0; j < p->unit_count; j++) {
+            for (int k = 0; k < PHASE_LINK; k++) phase_total[k] += p->units[j].phase_time[k];
+        }
+        phase_total[PHASE_LINK] += p->link_time;
+        unit_count += p->unit_count;
+    }
+    printf("Time report (%d units):\n", unit_count);
+    for (int k = 0; k < PHASE_COUNT; k++) {
+        printf("  %-10s %10.3f ms %5.1f%%\n", phase_names[k], phase_total[k] * 1e3, total > 0 ? phase_total[k] / total * 100 : 0);
+    }
+    printf("  %-10s %10.3f ms\n", "wall", total * 1e3);
+}
+
+int link_units(Project* p, int worker) {
+    const char** objects = malloc(p->unit_count * sizeof(char*));
+    if (!objects) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    objects[0] = p->units[p->unit_count - 1].obj_path;
+    for (int i = 0; i < p->unit_count - 1; i++) {
+        objects[i + 1] = p->units[i].obj_path;
+    }
+    int link_ok = 1;
+    double link_start = mono_time();
+    p->log[0] = '\0';
+    if (p->backend->builtin_link) {
+        link_executable(p->exe_path, objects, p->unit_count, p->log, sizeof(p->log));
+    } else {
+        char* out = str_printf("%s%s%s", p->backend->ld_out, p->exe_path, p->backend->exe_suffix);
+        const char** args = link_args(p->backend, out, objects, p->unit_count);
+        link_ok = run_tool(args, -1);
+        trace_span(&p->trace, "ld", "process", NULL, worker, link_start, mono_time());
+        free(args);
+        free(out);
+    }
+    free(objects);
+    return link_ok;
+}
+
+int link_project(Project* p, int worker) {
+    for (int i = 0; i < p->unit_count; i++) {
+        if (p->units[i].status) p->status = 1;
+    }
+    if (p->status) return 0;
+    jmp_buf jump;
+    jmp_buf* outer = fail_jump;
+    double start = mono_time();
+    if (setjmp(jump) != 0) {
+        fail_jump = outer;
+        p->status = 1;
+        return 0;
+    }
+    fail_jump = &jump;
+    int ok = link_units(p, worker);
+    fail_jump = outer;
+    double end = mono_time();
+    p->link_time = end - start;
+    trace_span(&p->trace, phase_names[PHASE_LINK], "phase", NULL, worker, start, end);
+    if (!ok) p->status = 1;
+    return ok;
+}
+
+CompileUnit* next_task(Scheduler* s, int self) {
+    CompileUnit* u = NULL;
+    for (int i = 0; !u && i < s->workers; i++) {
+        TaskDeque* d = &s->deques[(self + i) % s->workers];
+        pthread_mutex_lock(&d->lock);
+        if (d->head < d->tail) u = i == 0 ? s->tasks[d->head++] : s->tasks[--d->tail];
+        pthread_mutex_unlock(&d->lock);
+    }
+    return u;
+}
+
+void finish_task(Scheduler* s, CompileUnit* u, double start) {
+    finish_assembler(u);
+    trace_span(&u->trace, u->is_main ? "main" : "dependency", "unit", u->path, u->worker, start, mono_time());
+    if (!s->link) return;
+    Project* p = &s->projects[u->project];
+    pthread_mutex_lock(&s->lock);
+    int done = --p->pending == 0;
+    pthread_mutex_unlock(&s->lock);
+    if (done) link_project(p, u->worker);
+}
+
+void* build_worker(void* arg) {
+    Scheduler* s = arg;
+    pthread_mutex_lock(&s->lock);
+    int self = s->started++;
+    pthread_mutex_unlock(&s->lock);
+    int worker = self + 1;
+    CompileUnit* held = NULL;
+    double held_start = 0;
+    CompileUnit* u;
+    while ((u = next_task(s, self))) {
+        double start = mono_time();
+        u->worker = worker;
+        run_unit(u);
+        if (!watch_mode && (u->front || !u->variant)) free_unit(u);
+        if (held) finish_task(s, held, held_start);
+        held = NULL;
+        start_assembler(u);
+        if (u->tool) {
+            held = u;
+            held_start = start;
+            continue;
+        }
+        finish_task(s, u, start);
+    }
+    if (held) finish_task(s, held, held_start);
+    return NULL;
+}
+
+int cpu_count() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : (int)n;
+}
+
+int worker_count(int jobs) {
+    int n = job_limit > 0 ? job_limit : cpu_count();
+    return n < jobs ? n : jobs;
+}
+
+void build_units(Project* projects, int project_count, int link) {
+    int total = 0;
+    for (int i = 0; i < project_count; i++) total += projects[i].unit_count;
+    if (total == 0) return;
+    int nworkers = worker_count(total);
+    Scheduler s = { .projects = projects, .workers = nworkers, .started = 0, .link = link };
+    s.tasks = malloc(total * sizeof(CompileUnit*));
+    s.deques = malloc(nworkers * sizeof(TaskDeque));
+    pthread_t* workers = malloc(nworkers * sizeof(pthread_t));
+    if (!s.tasks || !s.deques || !workers) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    int n = 0;
+    for (int i = 0; i < project_count; i++) {
+        for (int j = 0; j < projects[i].unit_count; j++) s.tasks[n++] = &projects[i].units[j];
+    }
+    for (int i = 0; i < nworkers; i++) {
+        s.deques[i].head = (long long)total * i / nworkers;
+        s.deques[i].tail = (long long)total * (i + 1) / nworkers;
+        pthread_mutex_init(&s.deques[i].lock, NULL);
+    }
+    pthread_mutex_init(&s.lock, NULL);
+    int started = 0;
+    for (int i = 1; i < nworkers; i++) {
+        if (pthread_create(&workers[started], NULL, build_worker, &s) == 0) started++;
+    }
+    build_worker(&s);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    for (int i = 0; i < nworkers; i++) pthread_mutex_destroy(&s.deques[i].lock);
+    pthread_mutex_destroy(&s.lock);
+    free(workers);
+    free(s.deques);
+    free(s.tasks);
+}
+
+void clean_objects(Project* p) {
+    for (int i = 0; i < p->unit_count; i++) {
+        unlink(p->units[i].obj_path);
+        unlink(p->units[i].asm_path);
+    }
+    if (use_cache && p->index.main && !stdin_main) store_manifest(p);
+}
+
+void free_project(Project* p) {
+    for (int i = 0; i < p->unit_count; i++) {
+        if (watch_mode) free_unit(&p->units[i]);
+        free(p->units[i].trace.spans);
+        free(p->units[i].log);
+        free(p->units[i].asm_path);
+        free(p->units[i].obj_path);
+    }
+    free(p->trace.spans);
+    p->trace = (Trace){0};
+    free(p->units);
+    p->units = NULL;
+    p->unit_count = 0;
+    free(p->exe_path);
+    p->exe_path = NULL;
+    free_index(&p->index);
+}
+
+void add_units(Project* p, int index, const char* out) {
+    Config* c = &p->config;
+    const char* sep = *out ? "/" : "";
+    int unit_count = c->dep_count + 1;
+    CompileUnit* units = calloc(unit_count, sizeof(CompileUnit));
+    if (!units) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    p->units = units;
+    p->unit_count = unit_count;
+    p->pending = unit_count;
+    for (int i = 0; i < unit_count; i++) {
+        units[i].project = index;
+        units[i].config = c;
+        units[i].backend = p->backend;
+    }
+    long pid = (long)getpid();
+    for (int i = 0; i < c->dep_count; i++) {
+        units[i].path = c->deps[i];
+        units[i].asm_path = str_printf("%s%sdep%d.%ld.asm", out, sep, i, pid);
+        units[i].obj_path = str_printf("%s%sdep%d.%ld.o", out, sep, i, pid);
+    }
+    CompileUnit* main_unit = &units[c->dep_count];
+    main_unit->path = p->nrs_path;
+    main_unit->is_main = 1;
+    main_unit->asm_path = str_printf("%s%sout.%ld.asm", out, sep, pid);
+    main_unit->obj_path = str_printf("%s%smain.%ld.o", out, sep, pid);
+    p->exe_path = str_printf("%s%s%s", out, sep, c->kernel);
+}
+
+int setup_project(Project* p, int index, const char* out) {
+    Config* c = &p->config;
+    *c = (Config)CONFIG_DEFAULTS;
+    p->status = 0;
+    p->log[0] = '\0';
+    strtab_reset(&p->index.paths);
+    int ok = load_manifest(p) ? read_noi(c, NULL, p->dir, p->index.noi) : scan_project(p);
+    if (!ok) {
+        return 0;
+    }
+    p->nrs_path = p->index.main;
+    add_units(p, index, out);
+    return 1;
+}
+
+int print_units(Project* p) {
+    int cache_hits = 0;
+    for (int i = 0; i < p->unit_count; i++) {
+        CompileUnit* u = &p->units[i];
+        n0ryst_log(u->is_main ? "Compiling main file:" : "Compiling dependency:");
+        n0ryst_log(u->path);
+        fwrite(u->log, 1, u->log_pos, stdout);
+        if (u->status) p->status = 1;
+        cache_hits += u->cache_hit;
+    }
+    return cache_hits;
+}
+
+int build_project(Project* p) {
+    build_start = mono_time();
+    if (!setup_project(p, 0, "")) {
+        return 1;
     }
 
     n0ryst_log("n0ryst ver. 1.09, 2024-2025");
     n0ryst_log("Starting compilation");
 
-    for (int i = 0; i < config.dep_count; i++) {
-        n0ryst_log("Compiling dependency:");
-        n0ryst_log(config.deps[i]);
-        compile_file(config.deps[i], 0);
-        char obj_path[MAX_PATH];
-        snprintf(obj_path, MAX_PATH, "dep%d.o", i);
-        FILE* out = fopen("out.asm", "w");
-        fwrite(output_buf, 1, output_pos, out);
-        fclose(out);
-        char cmd[512];
-        snprintf(cmd, 512, "nasm -f %s out.asm -o %s",
-                 target_platform == PLATFORM_MACOS || target_platform == PLATFORM_IOS ? "macho64" :
-                 target_platform == PLATFORM_WINDOWS ? "win64" : "elf64", obj_path);
-        system(cmd);
-    }
-
-    n0ryst_log("Compiling main file:");
-    n0ryst_log(nrs_path);
-    compile_file(nrs_path, 1);
-
-    FILE* out = fopen("out.asm", "w");
-    if (!out) {
-        fprintf(stderr, "Error: Cannot write to out.asm\n");
+    if (use_cache) mkdir(CACHE_DIR, 0755);
+    lexer_select();
+    build_units(p, 1, 0);
+
+    int cache_hits = print_units(p);
+    if (p->status) return 1;
+    if (show_cache_stats) {
+        printf("Cache: %d hits, %d misses\n", cache_hits, p->unit_count - cache_hits);
+    }
+
+    double compiled = mono_time();
+    char msg[64];
+    snprintf(msg, sizeof(msg), "Compiled in %.3f seconds", compiled - build_start);
+    n0ryst_log(msg);
+
+    int link_ok = link_project(p, 0);
+    fputs(p->log, stdout);
+    double link_end = mono_time();
+    trace_span(&main_trace, "build", "build", NULL, 0, build_start, link_end);
+    if (time_report) print_time_report(p, 1, link_end - build_start);
+    if (trace_path) write_trace(p, 1);
+    return link_ok ? 0 : 1;
+}
+
+int build_batch(Project* projects, int project_count) {
+    build_start = mono_time();
+    n0ryst_log("n0ryst ver. 1.09, 2024-2025");
+    n0ryst_log("Starting batch compilation");
+    for (int i = 0; i < project_count; i++) {
+        if (!setup_project(&projects[i], i, projects[i].dir)) projects[i].status = 1;
+    }
+    if (use_cache) mkdir(CACHE_DIR, 0755);
+    lexer_select();
+    build_units(projects, project_count, 1);
+    double end = mono_time();
+
+    int built = 0;
+    int unit_count = 0;
+    int cache_hits = 0;
+    size_t bytes = 0;
+    for (int i = 0; i < project_count; i++) {
+        Project* p = &projects[i];
+        n0ryst_log("Project:");
+        n0ryst_log(p->dir);
+        cache_hits += print_units(p);
+        fputs(p->log, stdout);
+        for (int j = 0; j < p->unit_count; j++) bytes += p->units[j].bytes;
+        unit_count += p->unit_count;
+        if (p->status) {
+            n0ryst_log("Build failed");
+        } else {
+            built++;
+        }
+        clean_objects(p);
+    }
+    if (show_cache_stats) {
+        printf("Cache: %d hits, %d misses\n", cache_hits, unit_count - cache_hits);
+    }
+    double wall = end - build_start;
+    printf("Built %d of %d projects (%d units, %zu bytes) in %.3f seconds\n", built, project_count, unit_count, bytes, wall);
+    if (wall > 0) {
+        printf("Throughput: %.1f projects/s, %.1f units/s, %.2f MB/s\n", built / wall, unit_count / wall, bytes / wall / 1e6);
+    }
+    trace_span(&main_trace, "build", "build", NULL, 0, build_start, end);
+    if (time_report) print_time_report(projects, project_count, wall);
+    if (trace_path) write_trace(projects, project_count);
+    for (int i = 0; i < project_count; i++) free_project(&projects[i]);
+    return built == project_count ? 0 : 1;
+}
+
+int build_targets(Project* project) {
+    build_start = mono_time();
+    if (!setup_project(project, 0, "")) {
+        free_project(project);
+        return 1;
+    }
+    n0ryst_log("n0ryst ver. 1.09, 2024-2025");
+    n0ryst_log("Starting compilation");
+
+    Project* all = calloc(target_count + 1, sizeof(Project));
+    if (!all) {
+        fprintf(stderr, "Error: Out of memory\n");
         exit(1);
     }
-    fwrite(output_buf, 1, output_pos, out);
-    fclose(out);
-
-    n0ryst_log("Compiled in 0.XX seconds");
-
-    char cmd[512];
-    if (target_platform == PLATFORM_MACOS) {
-        snprintf(cmd, 512, "nasm -f macho64 out.asm -o main.o && ld -w -platform_version macos 10.15 10.15 -L/usr/lib -syslibroot /Applications/Xcode.app/Contents/Developer/Platforms/MacOSX.platform/Developer/SDKs/MacOSX.sdk -o %s main.o", config.kernel);
-    } else if (target_platform == PLATFORM_FREEBSD) {
-        snprintf(cmd, 512, "nasm -f elf64 out.asm -o main.o && ld.bfd -o %s main.o", config.kernel);
-    } else if (target_platform == PLATFORM_LINUX) {
-        snprintf(cmd, 512, "nasm -f elf64 out.asm -o main.o && ld -o %s main.o", config.kernel);
-    } else if (target_platform == PLATFORM_WINDOWS) {
-        snprintf(cmd, 512, "nasm -f win64 out.asm -o main.o && link /out:%s.exe main.o msvcrt.lib kernel32.lib", config.kernel);
-    } else if (target_platform == PLATFORM_IOS) {
-        snprintf(cmd, 512, "nasm -f macho64 out.asm -o main.o && ld -o %s main.o -lSystem -syslibroot /Applications/Xcode.app/Contents/Developer/Platforms/iPhoneOS.platform/Developer/SDKs/iPhoneOS.sdk", config.kernel);
-    } else {
-        snprintf(cmd, 512, "nasm -f elf64 out.asm -o main.o && ld -o %s main.o -lc", config.kernel);
-    }
-    for (int i = 0; i < config.dep_count; i++) {
-        char obj_path[MAX_PATH];
-        snprintf(obj_path, MAX_PATH, "dep%d.o", i);
-        strncat(cmd, " ", 512 - strlen(cmd) - 1);
-        strncat(cmd, obj_path, 512 - strlen(cmd) - 1);
-    }
-    if (target_platform == PLATFORM_MACOS) {
-        strncat(cmd, " -lSystem", 512 - strlen(cmd) - 1);
-    } else if (target_platform == PLATFORM_FREEBSD || target_platform == PLATFORM_LINUX || target_platform == PLATFORM_ANDROID) {
-        strncat(cmd, " -lc", 512 - strlen(cmd) - 1);
-    } else if (target_platform == PLATFORM_IOS) {
-        strncat(cmd, " -lSystem", 512 - strlen(cmd) - 1);
-    }
-    strncat(cmd, " && rm -f main.o out.asm", 512 - strlen(cmd) - 1);
-    for (int i = 0; i < config.dep_count; i++) {
-        char obj_path[MAX_PATH];
-        snprintf(obj_path, MAX_PATH, "dep%d.o", i);
-        strncat(cmd, " ", 512 - strlen(cmd) - 1);
-        strncat(cmd, obj_path, 512 - strlen(cmd) - 1);
-    }
-    system(cmd);
+    all[0] = *project;
+    Project* front = &all[0];
+    Project* targets = &all[1];
+    for (int t = 0; t < target_count; t++) {
+        Project* p = &targets[t];
+        p->dir = front->dir;
+        p->nrs_path = front->nrs_path;
+        p->config = front->config;
+        p->backend = &backends[target_list[t]];
+        mkdir(p->backend->name, 0755);
+        add_units(p, t, p->backend->name);
+        for (int i = 0; i < p->unit_count; i++) {
+            CompileUnit* u = &p->units[i];
+            u->path = front->units[i].path;
+            u->front = &front->units[i];
+            u->variant = u->front->variant;
+            u->front->variant = u;
+        }
+    }
+    if (use_cache) mkdir(CACHE_DIR, 0755);
+    lexer_select();
+    build_units(front, 1, 0);
+    print_units(front);
+    if (!front->status) build_units(targets, target_count, 1);
+    double end = mono_time();
+
+    int built = 0;
+    int unit_count = 0;
+    int cache_hits = 0;
+    for (int t = 0; t < target_count && !front->status; t++) {
+        Project* p = &targets[t];
+        n0ryst_log("Target:");
+        n0ryst_log(p->backend->name);
+        cache_hits += print_units(p);
+        fputs(p->log, stdout);
+        unit_count += p->unit_count;
+        if (p->status) {
+            n0ryst_log("Build failed");
+        } else {
+            built++;
+        }
+    }
+    if (show_cache_stats && !front->status) {
+        printf("Cache: %d hits, %d misses\n", cache_hits, unit_count - cache_hits);
+    }
+    if (!front->status) {
+        printf("Built %d of %d targets in %.3f seconds\n", built, target_count, end - build_start);
+    }
+    trace_span(&main_trace, "build", "build", NULL, 0, build_start, end);
+    if (time_report) print_time_report(all, target_count + 1, end - build_start);
+    if (trace_path) write_trace(all, target_count + 1);
+    for (int i = 0; i < front->unit_count; i++) {
+        release_source(&front->units[i]);
+        free_unit(&front->units[i]);
+    }
+    for (int i = 0; i <= target_count; i++) {
+        clean_objects(&all[i]);
+        free_project(&all[i]);
+    }
+    free(all);
+    return built == target_count ? 0 : 1;
+}
+
+uint64_t file_hash(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return 0;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) h = hash_bytes(h, buf, n);
+    fclose(f);
+    return h;
+}
+
+#ifdef __linux__
+typedef struct {
+    int wd;
+    char* path;
+} WatchDir;
+
+WatchDir* watch_dirs = NULL;
+int watch_dir_count = 0;
+int watch_dir_cap = 0;
+
+void watch_signal(int sig) {
+    (void)sig;
+    watch_stop = 1;
+}
+
+void watch_add(int fd, const char* path, size_t len) {
+    if (len == 0) return;
+    for (int i = 0; i < watch_dir_count; i++) {
+        if (strlen(watch_dirs[i].path) == len && strncmp(watch_dirs[i].path, path, len) == 0) return;
+    }
+    if (watch_dir_count == watch_dir_cap) {
+        watch_dir_cap = watch_dir_cap ? watch_dir_cap * 2 : 8;
+        watch_dirs = xrealloc(watch_dirs, watch_dir_cap * sizeof(WatchDir));
+    }
+    WatchDir* w = &watch_dirs[watch_dir_count];
+    w->path = str_printf("%.*s", (int)len, path);
+    w->wd = inotify_add_watch(fd, w->path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM);
+    if (w->wd < 0) {
+        fprintf(stderr, "Error: Cannot watch %s\n", w->path);
+        free(w->path);
+        return;
+    }
+    watch_dir_count++;
+}
+
+void watch_project_dirs(int fd, Project* p) {
+    watch_add(fd, p->dir, strlen(p->dir));
+    for (int i = 0; i < p->unit_count; i++) {
+        const char* path = p->units[i].path;
+        const char* slash = strrchr(path, '/');
+        if (slash) watch_add(fd, path, slash - path);
+    }
+}
 
+void watch_hash_objects(Project* p) {
+    for (int i = 0; i < p->unit_count; i++) {
+        CompileUnit* u = &p->units[i];
+        u->obj_hash = file_hash(u->obj_path);
+        if (u->status) u->key = 0;
+    }
+}
+
+int watch_project(Project* p) {
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot watch %s\n", p->dir);
+        return 1;
+    }
+    struct sigaction sa = { .sa_handler = watch_signal, .sa_flags = SA_RESETHAND };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    int need_link = build_project(p) != 0;
+    watch_hash_objects(p);
+    watch_project_dirs(fd, p);
+    printf("[Watch] Waiting for changes in %s\n", p->dir);
+    fflush(stdout);
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char* dirty = NULL;
+    while (!watch_stop) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        int reconfigure = 0;
+        dirty = xrealloc(dirty, p->unit_count);
+        memset(dirty, 0, p->unit_count);
+        for (;;) {
+            for (char* pos = buf; pos < buf + n; ) {
+                struct inotify_event* ev = (struct inotify_event*)pos;
+                pos += sizeof(*ev) + ev->len;
+                if (!ev->len) continue;
+                const char* parent = NULL;
+                for (int i = 0; i < watch_dir_count; i++) {
+                    if (watch_dirs[i].wd == ev->wd) parent = watch_dirs[i].path;
+                }
+                if (!parent) continue;
+                if (has_suffix(ev->name, ".noi")) {
+                    reconfigure = 1;
+                } else if (has_suffix(ev->name, ".nrs")) {
+                    char* path = str_printf("%s/%s", parent, ev->name);
+                    int unit = index_unit(&p->index, path);
+                    free(path);
+                    if (unit >= 0) dirty[unit] = 1;
+                    else if (!(ev->mask & IN_CLOSE_WRITE)) reconfigure = 1;
+                }
+            }
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            if (poll(&pfd, 1, WATCH_SETTLE_MS) <= 0) break;
+            n = read(fd, buf, sizeof(buf));
+            if (n <= 0) break;
+        }
+        double start = mono_time();
+        char msg[128];
+        if (reconfigure) {
+            clean_objects(p);
+            free_project(p);
+            need_link = build_project(p) != 0;
+            watch_hash_objects(p);
+            watch_project_dirs(fd, p);
+            snprintf(msg, sizeof(msg), "[Watch] %s in %.3f ms", need_link ? "Full rebuild failed" : "Full rebuild", (mono_time() - start) * 1e3);
+            n0ryst_log(msg);
+            fflush(stdout);
+            continue;
+        }
+        int rebuilt = 0;
+        int failed = 0;
+        for (int i = 0; i < p->unit_count; i++) {
+            if (!dirty[i]) continue;
+            CompileUnit* u = &p->units[i];
+            u->status = 0;
+            u->log_pos = 0;
+            u->cache_hit = 0;
+            u->unchanged = 0;
+            memset(u->phase_time, 0, sizeof(u->phase_time));
+            run_unit(u);
+            assemble_unit(u);
+            if (u->unchanged) continue;
+            rebuilt++;
+            n0ryst_log(u->is_main ? "Compiling main file:" : "Compiling dependency:");
+            n0ryst_log(u->path);
+            fwrite(u->log, 1, u->log_pos, stdout);
+            if (u->status) {
+                u->key = 0;
+                failed = 1;
+                continue;
+            }
+            uint64_t h = file_hash(u->obj_path);
+            if (h != u->obj_hash) need_link = 1;
+            u->obj_hash = h;
+        }
+        if (!rebuilt) continue;
+        double compiled = mono_time();
+        if (failed) {
+            snprintf(msg, sizeof(msg), "[Watch] Build failed after %.3f ms", (compiled - start) * 1e3);
+        } else if (need_link) {
+            int ok = link_project(p, 0);
+            fputs(p->log, stdout);
+            double linked = mono_time();
+            if (ok) need_link = 0;
+            snprintf(msg, sizeof(msg), "[Watch] Rebuilt %d unit%s in %.3f ms (link %.3f ms%s)", rebuilt, rebuilt == 1 ? "" : "s",
+                (linked - start) * 1e3, (linked - compiled) * 1e3, ok ? "" : ", failed");
+        } else {
+            snprintf(msg, sizeof(msg), "[Watch] Rebuilt %d unit%s in %.3f ms (objects unchanged, link skipped)", rebuilt, rebuilt == 1 ? "" : "s",
+                (compiled - start) * 1e3);
+        }
+        n0ryst_log(msg);
+        fflush(stdout);
+    }
+    close(fd);
+    free(dirty);
+    for (int i = 0; i < watch_dir_count; i++) free(watch_dirs[i].path);
+    free(watch_dirs);
+    clean_objects(p);
+    free_project(p);
+    n0ryst_log("[Watch] Stopped");
     return 0;
 }
+#else
+int watch_project(Project* p) {
+    (void)p;
+    fprintf(stderr, "Error: --watch is only supported on Linux\n");
+    return 1;
+}
+#endif
+
+void show_help() {
+    printf("n0ryst ver. 1.09, 2024-2025\n");
+    printf("Usage: n0ryst [options] [path...]\n");
+    printf("Options:\n");
+    printf("  --help    Show this help message\n");
+    printf("  --version Show version\n");
+    printf("  --target <platform>  Target platform (macos, freebsd, linux, windows, ios, android)\n");
+    printf("                       A comma-separated list builds each target into its own directory\n");
+    printf("  --emit-asm    Emit NASM text and assemble with nasm instead of writing ELF objects directly\n");
+    printf("  --no-cache    Rebuild every unit without using the object cache\n");
+    printf("  --cache-stats Print object cache hit/miss statistics\n");
+    printf("  -O0, -O1      Optimization level (-O1 runs peephole passes over the instruction list)\n");
+    printf("  --time-report Print time spent in each compile phase\n");
+    printf("  --trace=<file> Write a Chrome trace-event JSON profile of the build\n");
+    printf("  --watch       Stay running and rebuild changed units when sources change (Linux only)\n");
+    printf("  --stream      Lex, parse and emit one block at a time so memory stays bounded by the largest block\n");
+    printf("  --projects <file> Build every project directory listed in file, one per line\n");
+    printf("  -j <n>        Number of worker threads (default: one per CPU)\n");
+    printf("  --max-spawns <n> Maximum concurrent nasm/ld processes (default: one per CPU)\n");
+    printf("  path      Directory with .nrs and .noi files; several paths build as a batch\n");
+    printf("  -         Read the main file from stdin, with .noi and deps taken from the current directory\n");
+    exit(0);
+}
+
+void show_version() {
+    printf("n0ryst ver. 1.09, 2024-2025\n");
+    exit(0);
+}
+
+void add_project(Project** projects, int* count, int* cap, const char* dir) {
+    if (*count == *cap) {
+        *cap = *cap ? *cap * 2 : 4;
+        *projects = xrealloc(*projects, *cap * sizeof(Project));
+    }
+    Project* p = &(*projects)[(*count)++];
+    memset(p, 0, sizeof(*p));
+    p->dir = str_printf("%s", dir);
+}
+
+void read_project_list(const char* path, Project** projects, int* count, int* cap) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open file %s\n", path);
+        exit(1);
+    }
+    char* line = NULL;
+    size_t line_cap = 0;
+    while (read_line(f, &line, &line_cap)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char* dir = line;
+        while (isspace(*dir)) dir++;
+        if (*dir && *dir != '#') add_project(projects, count, cap, dir);
+    }
+    free(line);
+    fclose(f);
+}
+
+int parse_count(const char* flag, const char* val) {
+    char* end;
+    long n = strtol(val, &end, 10);
+    if (end == val || *end || n < 1 || n > INT_MAX) {
+        fprintf(stderr, "Error: Invalid %s value '%s'\n", flag, val);
+        exit(1);
+    }
+    return (int)n;
+}
+
+void parse_targets(const char* list) {
+    target_count = 0;
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        int platform = -1;
+        for (int i = 0; i < PLATFORM_COUNT; i++) {
+            if (strlen(backends[i].name) == len && strncmp(backends[i].name, list, len) == 0) platform = i;
+        }
+        if (platform < 0) {
+            fprintf(stderr, "Error: Invalid target platform '%.*s'\n", (int)len, list);
+            exit(1);
+        }
+        int seen = 0;
+        for (int i = 0; i < target_count; i++) seen |= target_list[i] == platform;
+        if (!seen) target_list[target_count++] = platform;
+        list += len;
+        if (*list == ',') list++;
+    }
+    if (target_count == 0) {
+        fprintf(stderr, "Error: Invalid target platform ''\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Project* projects = NULL;
+    int project_count = 0;
+    int project_cap = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            show_help();
+        } else if (strcmp(argv[i], "--version") == 0) {
+            show_version();
+        } else if (strcmp(argv[i], "--emit-asm") == 0) {
+            emit_asm = 1;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            use_cache = 0;
+        } else if (strcmp(argv[i], "--cache-stats") == 0) {
+            show_cache_stats = 1;
+        } else if (strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0) {
+            opt_level = argv[i][2] - '0';
+        } else if (strcmp(argv[i], "--time-report") == 0) {
+            time_report = 1;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_path = argv[i] + 8;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watch_mode = 1;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            stream_mode = 1;
+        } else if (strcmp(argv[i], "-") == 0) {
+            stdin_main = 1;
+            add_project(&projects, &project_count, &project_cap, ".");
+        } else if (strcmp(argv[i], "--projects") == 0 && i + 1 < argc) {
+            read_project_list(argv[++i], &projects, &project_count, &project_cap);
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            job_limit = parse_count("-j", argv[++i]);
+        } else if (strcmp(argv[i], "--max-spawns") == 0 && i + 1 < argc) {
+            spawn_slots = parse_count("--max-spawns", argv[++i]);
+        } else if (strcmp(argv[i], "--target") == 0 && i + 1 < argc) {
+            parse_targets(argv[++i]);
+        } else {
+            add_project(&projects, &project_count, &project_cap, argv[i]);
+        }
+    }
+    if (project_count == 0) add_project(&projects, &project_count, &project_cap, ".");
+    if (target_count == 0) target_list[target_count++] = PLATFORM_MACOS;
+    for (int i = 0; i < project_count; i++) projects[i].backend = &backends[target_list[0]];
+    if (spawn_slots < 1) spawn_slots = cpu_count();
+
+    int rc;
+    if (watch_mode && project_count > 1) {
+        fprintf(stderr, "Error: --watch takes a single project directory\n");
+        rc = 1;
+    } else if (stdin_main && (watch_mode || project_count > 1)) {
+        fprintf(stderr, "Error: - reads a single main file and cannot be combined with --watch or other paths\n");
+        rc = 1;
+    } else if (stream_mode && target_count > 1) {
+        fprintf(stderr, "Error: --stream builds a single target\n");
+        rc = 1;
+    } else if (target_count > 1 && (watch_mode || project_count > 1)) {
+        fprintf(stderr, "Error: Several targets need a single project without --watch\n");
+        rc = 1;
+    } else if (target_count > 1) {
+        recover_errors = 1;
+        rc = build_targets(&projects[0]);
+    } else if (watch_mode) {
+        recover_errors = 1;
+        rc = watch_project(&projects[0]);
+    } else if (project_count > 1) {
+        recover_errors = 1;
+        rc = build_batch(projects, project_count);
+    } else {
+        rc = build_project(&projects[0]);
+        clean_objects(&projects[0]);
+        free_project(&projects[0]);
+    }
+    free(main_trace.spans);
+    for (int i = 0; i < project_count; i++) free(projects[i].dir);
+    free(projects);
+    return rc;
+}
+